@@ -0,0 +1,663 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "stream_utils.hpp"
+#include "scene.hpp"
+
+// Every operator new of the process goes through these, so a benchmark can
+// count the heap allocations of a stretch of code.
+static std::atomic<long> allocations{0};
+
+void* operator new(std::size_t size) {
+    allocations++;
+    if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    allocations++;
+    size_t align = (size_t)alignment;
+    if (void* ptr = std::aligned_alloc(align, (size + align - 1) / align * align)) return ptr;
+    throw std::bad_alloc();
+}
+
+// out of line: inlined into std::allocator, GCC takes free() for a
+// mismatch with operator new
+__attribute__((noinline)) void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { operator delete(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { operator delete(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { operator delete(ptr); }
+
+// streambuf over a descriptor that counts the write syscalls it makes
+class CountingBuf: public std::streambuf {
+    int fd;
+    char buf[BUFSIZ];
+public:
+    long writes = 0;
+
+    CountingBuf(int fd): fd(fd) { setp(buf, buf + sizeof(buf)); }
+
+    int sync() override {
+        long n = pptr() - pbase();
+        if (n > 0) {
+            if (::write(fd, pbase(), n) < 0) return -1;
+            writes++;
+        }
+        setp(buf, buf + sizeof(buf));
+        return 0;
+    }
+
+    int_type overflow(int_type c) override {
+        if (sync() < 0) return traits_type::eof();
+        if (c != traits_type::eof()) {
+            *pptr() = (char)c;
+            pbump(1);
+        }
+        return c;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        if (n > epptr() - pptr()) {
+            if (sync() < 0) return 0;
+            if (n >= (std::streamsize)sizeof(buf)) {
+                if (::write(fd, s, n) < 0) return 0;
+                writes++;
+                return n;
+            }
+        }
+        std::memcpy(pptr(), s, n);
+        pbump(n);
+        return n;
+    }
+};
+
+static void fill_pattern(StreamHandler& sh, int frame) {
+    auto size = sh.size();
+    sh.clear();
+    for (int y=0; y<size.second; y++) {
+        for (int x=(y + frame)%7; x<size.first; x+=7) {
+            sh.at(x, y) = 'A' + (x + y)%26;
+        }
+    }
+}
+
+struct FlushResult {
+    double us_per_frame;
+    double writes_per_frame;
+};
+
+// the pre-framebuffer path: one string per row, std::endl after each
+static FlushResult bench_rows(int fd, int width, int height, int frames) {
+    using namespace std::chrono;
+    CountingBuf buf(fd);
+    std::ostream os(&buf);
+    std::vector< std::string > rows(height, std::string(width, ' '));
+
+    auto start = steady_clock::now();
+    for (int f=0; f<frames; f++) {
+        for (int y=0; y<height; y++) {
+            for (int x=0; x<width; x++) rows[y][x] = ' ';
+            for (int x=(y + f)%7; x<width; x+=7) rows[y][x] = 'A' + (x + y)%26;
+        }
+        for (auto& str: rows) {
+            os << str << std::endl;
+        }
+    }
+    double us = duration_cast<microseconds>(steady_clock::now() - start).count();
+    return {us/frames, (double)buf.writes/frames};
+}
+
+static FlushResult bench_stream(int fd, int width, int height, int frames) {
+    using namespace std::chrono;
+    CountingBuf buf(fd);
+    std::ostream os(&buf);
+    StreamHandler sh(os, width, height);
+
+    auto start = steady_clock::now();
+    for (int f=0; f<frames; f++) {
+        fill_pattern(sh, f);
+        sh.flush();
+    }
+    double us = duration_cast<microseconds>(steady_clock::now() - start).count();
+    return {us/frames, (double)buf.writes/frames};
+}
+
+static FlushResult bench_fd(int fd, int width, int height, int frames) {
+    using namespace std::chrono;
+    StreamHandler sh(std::cout, width, height);
+    sh.set_output_fd(fd);
+
+    long writes = 0;
+    auto start = steady_clock::now();
+    for (int f=0; f<frames; f++) {
+        fill_pattern(sh, f);
+        sh.flush();
+        writes += sh.last_flush_writes();
+    }
+    double us = duration_cast<microseconds>(steady_clock::now() - start).count();
+    return {us/frames, (double)writes/frames};
+}
+
+static void flush_benchmark(const char* path) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        std::perror(path);
+        return;
+    }
+
+    int sizes[][2] = {{80, 24}, {200, 60}, {1000, 300}};
+    std::printf("%-10s %-14s %12s %12s\n", "size", "path", "us/frame", "writes/frame");
+    for (auto& size: sizes) {
+        int frames = 20000000 / (size[0] * size[1]) + 10;
+        FlushResult results[] = {
+            bench_rows(fd, size[0], size[1], frames),
+            bench_stream(fd, size[0], size[1], frames),
+            bench_fd(fd, size[0], size[1], frames),
+        };
+        const char* names[] = {"rows+endl", "flush(stream)", "flush(fd)"};
+
+        std::string label = std::to_string(size[0]) + "x" + std::to_string(size[1]);
+        for (int i=0; i<3; i++) {
+            std::printf("%-10s %-14s %12.2f %12.2f\n", label.c_str(), names[i], results[i].us_per_frame, results[i].writes_per_frame);
+        }
+    }
+    close(fd);
+}
+
+static void triangle_benchmark() {
+    using namespace std::chrono;
+    int sizes[][2] = {{80, 24}, {200, 60}, {1000, 300}};
+    float scales[] = {0.05f, 0.25f, 1.0f};
+
+    std::printf("%-10s %8s %14s\n", "size", "scale", "triangles/s");
+    for (auto& size: sizes) {
+        StreamHandler sh(std::cout, size[0], size[1]);
+        for (float scale: scales) {
+            std::mt19937 rng(42);
+            std::uniform_real_distribution<float> pos(0, 1);
+            std::uniform_real_distribution<float> off(-0.5f, 0.5f);
+
+            const int count = 4096;
+            std::vector<float> coords(count * 6);
+            for (int i=0; i<count; i++) {
+                float cx = pos(rng)*size[0], cy = pos(rng)*size[1];
+                for (int j=0; j<3; j++) {
+                    coords[i*6 + j*2] = cx + off(rng)*scale*size[0];
+                    coords[i*6 + j*2 + 1] = cy + off(rng)*scale*size[1];
+                }
+            }
+
+            long drawn = 0;
+            auto start = steady_clock::now();
+            double elapsed = 0;
+            while (elapsed < 0.3) {
+                for (int i=0; i<count; i++) {
+                    const float* c = &coords[i*6];
+                    sh.draw_filled_triangle(c[0], c[1], c[2], c[3], c[4], c[5], 'A' + i%26);
+                }
+                drawn += count;
+                elapsed = duration<double>(steady_clock::now() - start).count();
+            }
+
+            std::string label = std::to_string(size[0]) + "x" + std::to_string(size[1]);
+            std::printf("%-10s %8.2f %14.0f\n", label.c_str(), scale, drawn/elapsed);
+        }
+    }
+}
+
+static void random_scene(StreamHandler& sh, int seed, int count) {
+    auto size = sh.size();
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> pos(-0.1f, 1.1f);
+    std::uniform_real_distribution<float> off(-0.05f, 0.05f);
+
+    for (int i=0; i<count; i++) {
+        float cx = pos(rng)*size.first, cy = pos(rng)*size.second;
+        float v[6];
+        for (int j=0; j<3; j++) {
+            v[j*2] = cx + off(rng)*size.first;
+            v[j*2 + 1] = cy + off(rng)*size.second;
+        }
+        char color = 'A' + i%26;
+        switch (i % 6) {
+            case 0: sh.draw_line(v[0], v[1], v[2], v[3], color); break;
+            case 1: sh.draw_triangle(v[0], v[1], v[2], v[3], v[4], v[5], color); break;
+            case 2: sh.draw_filled_triangle(v[0], v[1], v[2], v[3], v[4], v[5], color); break;
+            case 3: sh.draw_circle(cx, cy, std::abs(v[2] - cx), color); break;
+            case 4: sh.draw_filled_circle(cx, cy, std::abs(v[2] - cx), color); break;
+            case 5: sh.draw_filled_ellipse(cx, cy, std::abs(v[2] - cx), std::abs(v[3] - cy), color); break;
+        }
+    }
+}
+
+// the pre-span path: a plot per cell inside the disc
+static void put_disc(StreamHandler& sh, float x0, float y0, float R, char color) {
+    for (int y=std::floor(y0 - R); y<=std::ceil(y0 + R); y++) {
+        for (int x=std::floor(x0 - R); x<=std::ceil(x0 + R); x++) {
+            if ((x - x0)*(x - x0) + (y - y0)*(y - y0) <= R*R) sh.put(x, y, color);
+        }
+    }
+}
+
+static void disc_benchmark() {
+    using namespace std::chrono;
+    StreamHandler sh(std::cout, 200, 60);
+    float radii[] = {2, 8, 25};
+    const int count = 500;
+
+    std::printf("%-8s %-14s %14s\n", "radius", "path", "discs/s");
+    for (float R: radii) {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> px(0, 200), py(0, 60);
+        std::vector<float> centres(count * 2);
+        for (int i=0; i<count; i++) {
+            centres[i*2] = px(rng);
+            centres[i*2 + 1] = py(rng);
+        }
+
+        for (int path=0; path<2; path++) {
+            long drawn = 0;
+            auto start = steady_clock::now();
+            double elapsed = 0;
+            while (elapsed < 0.3) {
+                for (int i=0; i<count; i++) {
+                    if (path) sh.draw_filled_circle(centres[i*2], centres[i*2 + 1], R, 'o');
+                    else put_disc(sh, centres[i*2], centres[i*2 + 1], R, 'o');
+                }
+                drawn += count;
+                elapsed = duration<double>(steady_clock::now() - start).count();
+            }
+            std::printf("%-8.0f %-14s %14.0f\n", R, path ? "spans" : "put", drawn/elapsed);
+        }
+    }
+}
+
+// clear + flush_diff of a few moving shapes; invalidate() before the clear
+// and again before the flush stands in for the untracked full clear and
+// full-frame compare
+static void dirty_benchmark(const char* path) {
+    using namespace std::chrono;
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        std::perror(path);
+        return;
+    }
+
+    const int width = 1000, height = 300, frames = 2000;
+    std::printf("%-10s %12s %12s %12s\n", "tracking", "clear us", "flush us", "bytes/frame");
+    for (int tracked=0; tracked<2; tracked++) {
+        StreamHandler sh(std::cout, width, height);
+        sh.set_output_fd(fd);
+
+        double clear_us = 0, flush_us = 0;
+        size_t bytes = 0;
+        for (int f=0; f<frames; f++) {
+            if (!tracked) sh.invalidate();
+            auto start = steady_clock::now();
+            sh.clear();
+            clear_us += duration<double, std::micro>(steady_clock::now() - start).count();
+
+            float t = f * 0.05f;
+            for (int i=0; i<4; i++) {
+                float cx = width/2 + std::cos(t + i)*width/3;
+                float cy = height/2 + std::sin(t*1.3f + i)*height/3;
+                sh.draw_filled_triangle(cx, cy - 12, cx - 20, cy + 10, cx + 20, cy + 10, 'A' + i);
+            }
+            sh.draw_circle(width/2, height/2, 20 + f%20, 'o');
+            sh.draw_line(0, -1, width - 1, -1, '#');
+            sh.draw_line(0, height, width - 1, height, '#');
+
+            // clear() reset the extents, so mark the whole frame again
+            if (!tracked) sh.invalidate();
+            start = steady_clock::now();
+            sh.flush_diff();
+            flush_us += duration<double, std::micro>(steady_clock::now() - start).count();
+            bytes += sh.last_flush_bytes();
+        }
+        std::printf("%-10s %12.2f %12.2f %12zu\n", tracked ? "dirty" : "full", clear_us/frames, flush_us/frames, bytes/frames);
+    }
+    close(fd);
+}
+
+static void colored_scene(StreamHandler& sh, int frame) {
+    auto size = sh.size();
+    sh.clear();
+    for (int y=0; y<size.second; y += 4) {
+        sh.set_color(Color::index(232 + y*24/size.second), Color::rgb(0, 0, 40 + y*160/size.second));
+        sh.draw_filled_triangle(-1, y - 0.5f, size.first, y - 0.5f, -1, y + 3.5f, ' ');
+        sh.draw_filled_triangle(size.first, y - 0.5f, size.first, y + 3.5f, -1, y + 3.5f, ' ');
+    }
+    for (int i=0; i<12; i++) {
+        float t = frame*0.03f + i;
+        sh.set_color(Color::rgb(255, 40 + i*18, 60), Color::rgb(i*20, 30, 80));
+        sh.draw_filled_circle(size.first*(0.5f + 0.4f*std::cos(t)), size.second*(0.5f + 0.4f*std::sin(t*1.7f)), size.second/8.0f, '@');
+    }
+}
+
+// one complete SGR sequence in front of every cell
+static void append_naive_color(std::string& out, int base, Color color) {
+    switch (color.kind()) {
+        case Color::DEFAULT: out += std::to_string(base + 9); break;
+        case Color::INDEX: out += std::to_string(base + 8) + ";5;" + std::to_string(color.value & 0xff); break;
+        case Color::RGB:
+            out += std::to_string(base + 8) + ";2;" + std::to_string(color.value >> 16 & 0xff) + ";"
+                + std::to_string(color.value >> 8 & 0xff) + ";" + std::to_string(color.value & 0xff);
+            break;
+    }
+}
+
+static void encode_naive(const StreamHandler& sh, std::string& out) {
+    auto size = sh.size();
+    out.clear();
+    for (int y=0; y<size.second; y++) {
+        for (int x=0; x<size.first; x++) {
+            auto colors = sh.colors_at(x, y);
+            out += "\x1b[";
+            append_naive_color(out, 30, colors.first);
+            out += ';';
+            append_naive_color(out, 40, colors.second);
+            out += 'm';
+            out += sh.at(x, y);
+        }
+        out += "\x1b[0m\n";
+    }
+}
+
+static void color_benchmark(const char* path) {
+    using namespace std::chrono;
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        std::perror(path);
+        return;
+    }
+
+    int sizes[][2] = {{80, 24}, {200, 60}, {1000, 300}};
+    std::printf("%-10s %-14s %12s %12s\n", "size", "encoder", "us/frame", "bytes/frame");
+    for (auto& size: sizes) {
+        const int frames = 200;
+        std::string label = std::to_string(size[0]) + "x" + std::to_string(size[1]);
+        const char* names[] = {"naive", "runs(full)", "runs(diff)"};
+
+        for (int encoder=0; encoder<3; encoder++) {
+            StreamHandler sh(std::cout, size[0], size[1]);
+            sh.set_output_fd(fd);
+            std::string out;
+            double us = 0;
+            size_t bytes = 0;
+            for (int f=0; f<frames; f++) {
+                colored_scene(sh, f);
+                auto start = steady_clock::now();
+                if (encoder == 0) {
+                    encode_naive(sh, out);
+                    if (::write(fd, out.data(), out.size()) < 0) break;
+                    bytes += out.size();
+                }
+                else {
+                    if (encoder == 1) sh.flush();
+                    else sh.flush_diff();
+                    bytes += sh.last_flush_bytes();
+                }
+                us += duration<double, std::micro>(steady_clock::now() - start).count();
+            }
+            std::printf("%-10s %-14s %12.2f %12zu\n", label.c_str(), names[encoder], us/frames, bytes/frames);
+        }
+    }
+    close(fd);
+}
+
+struct StageTimes {
+    std::vector<double> samples;
+
+    void add(double us) { samples.push_back(us); }
+
+    double percentile(double p) {
+        std::sort(samples.begin(), samples.end());
+        size_t i = (size_t)std::ceil(p * samples.size()) - 1;
+        return samples[(std::min)(i, samples.size() - 1)];
+    }
+
+    double mean() const {
+        double sum = 0;
+        for (double s: samples) sum += s;
+        return sum / samples.size();
+    }
+
+    void print(const char* name) {
+        std::printf("\"%s\": {\"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f}", name, mean(), percentile(0.5), percentile(0.99));
+    }
+};
+
+// The lab0 scene for a fixed number of frames, without a terminal. Output
+// goes to a file or, for "-", an std::ostringstream. Prints JSON.
+static void scene_benchmark(const char* path) {
+    using namespace std::chrono;
+    bool to_stream = std::string(path) == "-";
+    int fd = to_stream ? -1 : open(path, O_WRONLY);
+    if (!to_stream && fd < 0) {
+        std::perror(path);
+        return;
+    }
+
+    int sizes[][2] = {{80, 24}, {200, 60}, {1000, 300}};
+    const int frames = 1000;
+    std::printf("{\"benchmark\": \"scene\", \"output\": \"%s\", \"frames\": %d, \"results\": [\n", to_stream ? "ostringstream" : path, frames);
+    for (auto& size: sizes) {
+        std::ostringstream os;
+        StreamHandler sh(os, size[0], size[1]);
+        if (!to_stream) sh.set_output_fd(fd);
+
+        StageTimes clear, draw, flush, frame;
+        size_t bytes = 0;
+        float t = 0, t1 = 0;
+        for (int f=0; f<frames; f++) {
+            auto start = steady_clock::now();
+            sh.clear();
+            auto cleared = steady_clock::now();
+            draw_scene(sh, t, t1);
+            auto drawn = steady_clock::now();
+            sh.flush_diff();
+            auto flushed = steady_clock::now();
+
+            clear.add(duration<double, std::micro>(cleared - start).count());
+            draw.add(duration<double, std::micro>(drawn - cleared).count());
+            flush.add(duration<double, std::micro>(flushed - drawn).count());
+            frame.add(duration<double, std::micro>(flushed - start).count());
+            bytes += sh.last_flush_bytes();
+            if (to_stream) os.str("");
+            t += 0.15;
+            t1 += 0.4;
+        }
+
+        std::printf("  {\"width\": %d, \"height\": %d, \"bytes_per_frame\": %zu, ", size[0], size[1], bytes/frames);
+        clear.print("clear_us");
+        std::printf(", ");
+        draw.print("draw_us");
+        std::printf(", ");
+        flush.print("flush_us");
+        std::printf(", ");
+        frame.print("frame_us");
+        std::printf("}%s\n", &size == &sizes[2] ? "" : ",");
+    }
+    std::printf("]}\n");
+    if (fd >= 0) close(fd);
+}
+
+// Moving discs and triangles on a 120x40 terminal, drawn once per cell and
+// once per sub-cell pixel: canvas pixels, bytes per frame of DIFF output
+// and time per frame.
+static void subcell_benchmark(const char* path) {
+    using namespace std::chrono;
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        std::perror(path);
+        return;
+    }
+
+    const int columns = 120, rows = 40, frames = 1000;
+    const char* names[] = {"text", "halfblocks", "braille"};
+    StreamHandler::Glyphs modes[] = {StreamHandler::TEXT, StreamHandler::HALF_BLOCKS, StreamHandler::BRAILLE};
+    std::printf("%-12s %12s %12s %12s %12s\n", "glyphs", "pixels", "canvas B", "bytes/frame", "frame us");
+    for (int m=0; m<3; m++) {
+        StreamHandler sh(std::cout, columns, rows);
+        sh.set_output_fd(fd);
+        SubcellCanvas canvas(sh, modes[m]);
+        auto size = modes[m] == StreamHandler::TEXT ? sh.size() : canvas.size();
+        float w = size.first, h = size.second;
+
+        size_t bytes = 0;
+        auto start = steady_clock::now();
+        for (int f=0; f<frames; f++) {
+            float t = f * 0.05f;
+            sh.clear();
+            for (int i=0; i<4; i++) {
+                float cx = w/2 + std::cos(t + i)*w/3;
+                float cy = h/2 + std::sin(t*1.3f + i)*h/3;
+                if (modes[m] == StreamHandler::TEXT) {
+                    sh.draw_filled_triangle(cx, cy - h/8, cx - w/12, cy + h/10, cx + w/12, cy + h/10, '#');
+                    sh.draw_ellipse(w - cx, h - cy, w/16, h/8, 'o');
+                }
+                else {
+                    canvas.draw_filled_triangle(cx, cy - h/8, cx - w/12, cy + h/10, cx + w/12, cy + h/10);
+                    canvas.draw_ellipse(w - cx, h - cy, w/16, h/8);
+                }
+            }
+            sh.flush_diff();
+            bytes += sh.last_flush_bytes();
+        }
+        double us = duration<double, std::micro>(steady_clock::now() - start).count();
+        std::printf("%-12s %12.0f %12d %12zu %12.2f\n", names[m], w*h, (columns + 1)*rows, bytes/frames, us/frames);
+    }
+    close(fd);
+}
+
+// 10k frames of the scene with a resize every few frames to a random size,
+// immediate and deferred. The run is made twice: the first one reaches the
+// largest canvas and bins the workload needs, in the second nothing may
+// allocate.
+static bool resize_check(const char* path) {
+    int fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        std::perror(path);
+        return false;
+    }
+
+    const int max_width = 300, max_height = 100, frames = 10000;
+    bool passed = true;
+    std::printf("%-10s %-7s %8s %14s %14s\n", "drawing", "output", "resizes", "allocs first", "allocs second");
+    for (int config=0; config<4; config++) {
+        // with the writer thread, as main runs
+        bool deferred = config & 1, threaded = config & 2;
+        StreamHandler sh(std::cout, max_width, max_height);
+        sh.set_output_fd(fd);
+        sh.show_stats(true);
+        if (deferred) sh.set_deferred(true, 4);
+        if (threaded) sh.start_writer(StreamHandler::DIFF, StreamHandler::DROP_OLDEST);
+
+        long counts[2], resizes = 0;
+        for (int pass=0; pass<2; pass++) {
+            std::mt19937 rng(7);
+            std::uniform_int_distribution<int> w(1, max_width), h(1, max_height), every(1, 20);
+            float t = 0, t1 = 0;
+            long before = allocations;
+            for (int f=0; f<frames; f++) {
+                if (every(rng) == 1) {
+                    int width = w(rng), height = h(rng);
+                    sh.resize(width, height);
+                    resizes++;
+                }
+                sh.clear();
+                draw_scene(sh, t, t1);
+                sh.present();
+                t += 0.15;
+                t1 += 0.4;
+            }
+            counts[pass] = allocations - before;
+        }
+        sh.stop_writer();
+        passed = passed && counts[1] == 0;
+        std::printf("%-10s %-7s %8ld %14ld %14ld\n", deferred ? "deferred" : "immediate", threaded ? "writer" : "inline",
+            resizes/2, counts[0], counts[1]);
+    }
+    close(fd);
+    std::printf("%s\n", passed ? "ok" : "FAILED: steady-state frames allocate");
+    return passed;
+}
+
+static void tiles_benchmark() {
+    using namespace std::chrono;
+    int sizes[][2] = {{1000, 300}, {2000, 600}, {4000, 1200}};
+    int max_threads = (std::max)(1u, std::thread::hardware_concurrency());
+    const int count = 20000;
+
+    // powers of two below max_threads, then max_threads itself
+    std::vector<int> thread_counts;
+    for (int threads=1; threads<max_threads; threads*=2) thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+
+    std::printf("%-10s %8s %12s %10s %10s\n", "size", "threads", "ms/frame", "speedup", "identical");
+    for (auto& size: sizes) {
+        const int frames = 5;
+        StreamHandler serial(std::cout, size[0], size[1]);
+        double serial_ms = 0;
+        for (int f=0; f<frames; f++) {
+            serial.clear();
+            auto start = steady_clock::now();
+            random_scene(serial, 7, count);
+            serial_ms += duration<double, std::milli>(steady_clock::now() - start).count();
+        }
+        serial_ms /= frames;
+
+        std::string label = std::to_string(size[0]) + "x" + std::to_string(size[1]);
+        std::printf("%-10s %8s %12.2f %10.2f %10s\n", label.c_str(), "serial", serial_ms, 1.0, "-");
+
+        for (int threads: thread_counts) {
+            StreamHandler sh(std::cout, size[0], size[1]);
+            sh.set_deferred(true, threads);
+
+            double ms = 0;
+            for (int f=0; f<frames; f++) {
+                sh.clear();
+                auto start = steady_clock::now();
+                random_scene(sh, 7, count);
+                sh.submit();
+                ms += duration<double, std::milli>(steady_clock::now() - start).count();
+            }
+
+            bool identical = true;
+            for (int y=0; y<size[1]; y++) {
+                identical = identical && std::memcmp(&serial.at(0, y), &sh.at(0, y), size[0]) == 0;
+            }
+            std::printf("%-10s %8d %12.2f %10.2f %10s\n", label.c_str(), threads, ms/frames, serial_ms/(ms/frames), identical ? "yes" : "NO");
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string mode = argc > 1 ? argv[1] : "flush";
+    const char* path = argc > 2 ? argv[2] : "/dev/null";
+
+    if (mode == "flush") flush_benchmark(path);
+    else if (mode == "triangles") triangle_benchmark();
+    else if (mode == "tiles") tiles_benchmark();
+    else if (mode == "discs") disc_benchmark();
+    else if (mode == "dirty") dirty_benchmark(path);
+    else if (mode == "colors") color_benchmark(path);
+    else if (mode == "scene") scene_benchmark(path);
+    else if (mode == "subcell") subcell_benchmark(path);
+    else if (mode == "resize") return resize_check(path) ? 0 : 1;
+    else {
+        std::cerr << "usage: " << argv[0] << " [flush [output] | triangles | tiles | discs | dirty [output] | colors [output] | scene [output|-] | subcell [output] | resize [output]]" << std::endl;
+        return 1;
+    }
+    return 0;
+}
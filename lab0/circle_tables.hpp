@@ -0,0 +1,50 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+
+// Unit circle pre-split into 8, 16, ..., 256 segments: ellipse vertices
+// come from a table instead of a cos/sin per vertex. The points have x and
+// y like the labs' own Point, so callers scale them without converting.
+const int min_segments = 8;
+const int max_segments = 256;
+
+struct UnitPoint {
+    double x, y;
+};
+
+// Table level for segments, rounded up to a power of two.
+inline size_t circle_level(int segments) {
+    size_t level = 0;
+    while ((min_segments << level) < segments && (min_segments << level) < max_segments) level++;
+    return level;
+}
+
+// n+1 points, the last one equal to the first.
+inline const std::vector<UnitPoint>& unit_circle(int segments) {
+    static const auto tables = [] {
+        const double pi = std::acos(-1.0);
+        std::vector< std::vector<UnitPoint> > tables;
+        for (int n=min_segments; n<=max_segments; n*=2) {
+            std::vector<UnitPoint> table;
+            for (int i=0; i<n; i++) {
+                table.push_back({std::cos(2*pi*i/n), std::sin(2*pi*i/n)});
+            }
+            table.push_back(table[0]);
+            tables.push_back(table);
+        }
+        return tables;
+    }();
+
+    return tables[circle_level(segments)];
+}
+
+// How many segments keep a chord within tolerance pixels of an arc of the
+// given radius in pixels: radius*(1 - cos(pi/n)) <= tolerance.
+inline int circle_segments(double radius, double tolerance = 0.25) {
+    if (radius <= tolerance) return min_segments;
+    double n = std::acos(-1.0) / std::acos(1 - tolerance/radius);
+    if (n >= max_segments) return max_segments;
+    return n > min_segments ? (int)std::ceil(n) : min_segments;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+#include <cmath>
+#include <cerrno>
+#include <ctime>
+
+// Fixed-timestep frame loop. advance() runs the simulation in steps of
+// constant length, as many as the real time since the previous frame
+// holds, so its speed doesn't depend on how long frames take; alpha() is
+// how far the render time is past the last step, for interpolation.
+// wait() sleeps until the absolute end of the frame, so an imprecise
+// sleep doesn't shift the frames after it.
+class FrameScheduler {
+    using clock = std::chrono::steady_clock;
+
+    clock::duration period;
+    double step_length;
+    int max_steps = 8;          // per frame, so a stall doesn't snowball
+
+    bool started = false;
+    clock::time_point deadline; // end of the current frame
+    clock::time_point last;     // time advance() simulated up to
+    double accumulator = 0;     // seconds not simulated yet
+
+    long frames = 0, missed = 0;
+    double jitter_sum = 0, jitter_max = 0;  // microseconds late on wake-up
+
+    void start() {
+        started = true;
+        last = clock::now();
+        deadline = last + period;
+    }
+
+    static void sleep_until(clock::time_point when) {
+#ifndef _WIN32
+        // steady_clock is CLOCK_MONOTONIC
+        auto ns = std::chrono::duration_cast< std::chrono::nanoseconds >(when.time_since_epoch()).count();
+        timespec ts = {(time_t)(ns / 1000000000), (long)(ns % 1000000000)};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+#else
+        std::this_thread::sleep_until(when);
+#endif
+    }
+public:
+    // step <= 0 means one step per frame
+    FrameScheduler(double fps, double step = 0) {
+        set_fps(fps);
+        step_length = step > 0 ? step : 1 / fps;
+    }
+
+    void set_fps(double fps) {
+        period = std::chrono::duration_cast< clock::duration >(std::chrono::duration<double>(1 / fps));
+    }
+    void set_step(double step) { step_length = step; }
+    double step() const { return step_length; }
+
+    // Calls update(step) for every whole step due and returns their count.
+    // Past max_steps the backlog is dropped and the simulation slows down.
+    template< class Update >
+    int advance(Update&& update) {
+        if (!started) start();
+        auto now = clock::now();
+        accumulator += std::chrono::duration<double>(now - last).count();
+        last = now;
+
+        int steps = 0;
+        while (accumulator >= step_length && steps < max_steps) {
+            update(step_length);
+            accumulator -= step_length;
+            steps++;
+        }
+        if (steps == max_steps) accumulator = std::fmod(accumulator, step_length);
+        return steps;
+    }
+
+    // fraction of a step simulated time lags behind, in [0, 1)
+    double alpha() const { return accumulator / step_length; }
+
+    // Sleeps until the frame deadline. An overrun frame counts as missed and
+    // the schedule restarts from now instead of rushing the next frames.
+    void wait() {
+        if (!started) start();
+        frames++;
+        auto now = clock::now();
+        if (now >= deadline) {
+            missed++;
+            deadline = now + period;
+            return;
+        }
+        sleep_until(deadline);
+        double late = std::chrono::duration<double, std::micro>(clock::now() - deadline).count();
+        jitter_sum += late;
+        if (late > jitter_max) jitter_max = late;
+        deadline += period;
+    }
+
+    long frame_count() const { return frames; }
+    long missed_deadlines() const { return missed; }
+    // wake-up delay past the deadline of the frames that made it
+    double mean_jitter_us() const { return frames > missed ? jitter_sum / (frames - missed) : 0; }
+    double max_jitter_us() const { return jitter_max; }
+};
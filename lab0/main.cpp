@@ -1,15 +1,67 @@
+#include "frame_scheduler.hpp"
 #include "stream_utils.hpp"
+#include "scene.hpp"
 
 #include <iostream>
+#include <string>
+#include <cstdlib>
+#include <csignal>
+#include <memory>
 #include <unistd.h>
 
 #ifdef _WIN32
 #include <windows.h>
 #else
 #include <sys/ioctl.h>
+#include "recording.hpp"
+#endif
+
+// кадров в секунду; сцена идёт шагами по 0.1 с, как раньше шла за кадр
+const double fps = 30;
+const double step = 0.1;
+
+static volatile std::sig_atomic_t running = 1;
+static volatile std::sig_atomic_t resized = 0;
+
+static void stop(int) {
+    running = 0;
+}
+
+static void on_resize(int) {
+    resized = 1;
+}
+
+#ifndef _WIN32
+// Проигрывание записи без пересчёта геометрии, с кадра start.
+static int replay(const char* path, long start) {
+    Replay replay(path);
+    if (!replay.is_open()) {
+        std::cerr << path << ": not a recording" << std::endl;
+        return 1;
+    }
+    if (start > 0) replay.seek(start);
+
+    std::cout << "\x1b[2J" << std::flush;
+    FrameScheduler scheduler(fps);
+    while (running && replay.play(STDOUT_FILENO)) {
+        scheduler.wait();
+    }
+    return 0;
+}
+#endif
+
+// ./main                     - анимация в терминале
+// ./main record FILE         - то же, с записью кадров в FILE
+// ./main replay FILE [FRAME] - проигрывание записи
+int main(int argc, char** argv) {
+    std::string mode = argc > 1 ? argv[1] : "";
+    // и для проигрывания: Ctrl-C останавливает его между кадрами
+    std::signal(SIGINT, stop);
+#ifndef _WIN32
+    if (mode == "replay" && argc > 2) return replay(argv[2], argc > 3 ? std::atol(argv[3]) : 0);
+    std::signal(SIGWINCH, on_resize);
 #endif
 
-int main() {
     int columns, rows;
 
 #ifdef _WIN32
@@ -24,65 +76,67 @@ int main() {
     rows = w.ws_row;
 #endif
 
-    StreamHandler sh(std::cout, rows, 0.5f);
+    // последняя строка терминала - под статистику вывода
+    StreamHandler sh(std::cout, rows - 1, 0.5f);
     // StreamHandler sh(std::cout, columns, rows);
+#ifndef _WIN32
+    sh.set_output_fd(STDOUT_FILENO);
+#endif
+    sh.show_stats(true);
 
     auto size = sh.size();
     int sizex = size.first;
     int sizey = size.second;
     std::cout << sizex << " " << sizey << std::endl;
 
-    
     float t = 0;
     float t1 = 0;
-    float pi = 3.1415;
-    float k = 1;
-    while (1) {
-        sh.clear();
 
-        
-        {
-            // внешний треугольник
-            float x0, y0, x1, y1, x2, y2;
-            x0 = sizex/2 + k*std::cos(t)*sizex/2;
-            y0 = sizey/2 + k*std::sin(t)*sizey/2;
-            
-            x1 = sizex/2 + k*std::cos(t + 2*pi/3)*sizex/2;
-            y1 = sizey/2 + k*std::sin(t + 2*pi/3)*sizey/2;
-            
-            x2 = sizex/2 + k*std::cos(t + 2*pi*2/3)*sizex/2;
-            y2 = sizey/2 + k*std::sin(t + 2*pi*2/3)*sizey/2;
-            
-            sh.draw_circle((x0 + x1 + x2)/3, (y0 + y1 + y2)/3, 5, 'o');
-            sh.draw_triangle(x0, y0, x1, y1, x2, y2, 'A');
+#ifndef _WIN32
+    std::unique_ptr< Recorder > recorder;
+    if (mode == "record" && argc > 2) {
+        recorder.reset(new Recorder(argv[2], sizex, sizey));
+        if (!recorder->is_open()) {
+            std::perror(argv[2]);
+            return 1;
         }
-        {
-            float x0, y0, x1, y1, x2, y2;
-
-            x0 = sizex/2 + (3.0/2.0 - 1.0/2.0)/std::sqrt(4)*k*std::cos(-t1)*sizex/2;
-            y0 = sizey/2 + (3.0/2.0 - 1.0/2.0)/std::sqrt(4)*k*std::sin(-t1)*sizey/2;
-            
-            x1 = sizex/2 + (3.0/2.0 - 1.0/2.0)/std::sqrt(4)*k*std::cos(-t1 + 2*pi/3)*sizex/2;
-            y1 = sizey/2 + (3.0/2.0 - 1.0/2.0)/std::sqrt(4)*k*std::sin(-t1 + 2*pi/3)*sizey/2;
-            
-            x2 = sizex/2 + (3.0/2.0 - 1.0/2.0)/std::sqrt(4)*k*std::cos(-t1 + 2*pi*2/3)*sizex/2;
-            y2 = sizey/2 + (3.0/2.0 - 1.0/2.0)/std::sqrt(4)*k*std::sin(-t1 + 2*pi*2/3)*sizey/2;
-
-            sh.draw_triangle(x0, y0, x1, y1, x2, y2, 'B');
+    }
+#endif
+
+    // вывод в терминал идёт в отдельном потоке, пока рисуется следующий кадр
+    sh.start_writer(StreamHandler::DIFF, StreamHandler::DROP_OLDEST);
+    FrameScheduler scheduler(fps, step);
+    while (running) {
+#ifndef _WIN32
+        // новый размер окна; запись идёт в одном размере, при ней окно не отслеживается
+        if (resized && !recorder) {
+            resized = 0;
+            ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+            int height = (std::max)(w.ws_row - 1, 1);
+            sh.resize((int)std::lround(height / sh.koef()), height);
         }
-        
-        
-        sh.draw_line(0, 0, 0, sizey, '@');
-        sh.draw_line(0, 0, sizex, 0, '@');
-        sh.draw_line(sizex, 0, sizex, sizey, '@');
-        sh.draw_line(0, sizey, sizex, sizey, '@');
-
-        sh.flush_ansi();
+#endif
+        scheduler.advance([&](double) {
+            t += 0.15;
+            t1 += 0.4;
+        });
+
+        sh.clear();
+        // положение между двумя шагами симуляции
+        float alpha = scheduler.alpha();
+        draw_scene(sh, t + 0.15f*alpha, t1 + 0.4f*alpha);
+#ifndef _WIN32
+        // кадр пишется до present(): после него холст - уже другой буфер
+        if (recorder) recorder->add(sh.frame());
+#endif
+
+        sh.present();
         // std::cout << sizex << " " << sizey << std::endl;
-        usleep(100000);
-        t += 0.15;
-        t1 += 0.4;
+        scheduler.wait();
     }
 
+    sh.stop_writer();
+    std::cout << "\nframes: " << scheduler.frame_count() << "  missed: " << scheduler.missed_deadlines()
+              << "  jitter: " << scheduler.mean_jitter_us() << " us mean, " << scheduler.max_jitter_us() << " us max" << std::endl;
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Objects kept densely in one vector and addressed through generational
+// handles. remove() moves the last object into the freed place, so it is
+// O(1) but only keeps the order of the objects in front of the removed one.
+// A handle to a removed object stops resolving even after its slot is
+// reused, because the slot's generation has moved on.
+template< class T >
+class ObjectStore {
+public:
+    struct Handle {
+        uint32_t index = UINT32_MAX;
+        uint32_t generation = 0;
+    };
+
+private:
+    static constexpr uint32_t none = UINT32_MAX;
+
+    struct Slot {
+        uint32_t dense;       // position of the object, or the next free slot
+        uint32_t generation;
+    };
+
+    std::vector<T> objects;
+    std::vector<uint32_t> owners;   // slot of every object
+    std::vector<Slot> slots;
+    uint32_t free_head = none;
+
+public:
+    Handle add(T obj) {
+        uint32_t index;
+        if (free_head != none) {
+            index = free_head;
+            free_head = slots[index].dense;
+        }
+        else {
+            index = slots.size();
+            slots.push_back({0, 0});
+        }
+        slots[index].dense = objects.size();
+        objects.push_back(std::move(obj));
+        owners.push_back(index);
+        return {index, slots[index].generation};
+    }
+
+    bool contains(Handle h) const {
+        return h.index < slots.size() && slots[h.index].generation == h.generation;
+    }
+
+    T* get(Handle h) {
+        return contains(h) ? &objects[slots[h.index].dense] : nullptr;
+    }
+
+    bool remove(Handle h) {
+        if (!contains(h)) return false;
+        remove_at(slots[h.index].dense);
+        return true;
+    }
+
+    // Removes the i-th object; the last one takes its place, so a loop over
+    // the objects that removes at i has to look at i again.
+    void remove_at(size_t i) {
+        uint32_t slot = owners[i];
+        if (i + 1 != objects.size()) {
+            objects[i] = std::move(objects.back());
+            owners[i] = owners.back();
+            slots[owners[i]].dense = i;
+        }
+        objects.pop_back();
+        owners.pop_back();
+
+        slots[slot].generation++;  // also marks the slot free for contains()
+        slots[slot].dense = free_head;
+        free_head = slot;
+    }
+
+    void clear() {
+        while (!objects.empty()) remove_at(objects.size() - 1);
+    }
+
+    size_t size() const { return objects.size(); }
+    bool empty() const { return objects.empty(); }
+    T& operator[](size_t i) { return objects[i]; }
+
+    auto begin() { return objects.begin(); }
+    auto end() { return objects.end(); }
+
+    // storage high-water marks: stay flat while adds and removes balance
+    size_t capacity() const { return objects.capacity(); }
+    size_t slot_count() const { return slots.size(); }
+};
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <charconv>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "stream_utils.hpp"
+
+// Recording file: a header, then one record per frame, appended as the
+// frames come. A record is {kind, size} and a payload:
+//   KEY    the frame as it lies in CharFrame, rows with their '\n' slots
+//   DELTA  runs of the frame that differ from the previous one, each a
+//          varint skip from the end of the last run, a varint length and
+//          the new bytes; runs never cross a row end
+// Every keyframe_interval-th frame is a keyframe. close() appends an index
+// of the keyframes and a trailer pointing at it; a file cut short without
+// them is still readable, Replay then scans the records instead.
+namespace recording {
+
+const char magic[4] = {'A', 'S', 'C', 'R'};
+const char trailer_magic[8] = {'A', 'S', 'C', 'R', 'I', 'N', 'D', 'X'};
+enum Kind: uint32_t { KEY = 1, DELTA = 2, INDEX = 3 };
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t width, height;
+    uint32_t keyframe_interval;
+    uint32_t reserved;
+};
+
+struct Record {
+    uint32_t kind;
+    uint32_t size;
+};
+
+// INDEX payload: one entry per keyframe
+struct IndexEntry {
+    uint64_t frame;
+    uint64_t offset;
+};
+
+struct Trailer {
+    uint64_t index_offset;
+    uint64_t frames;
+    char magic[8];
+};
+
+}
+
+class Recorder {
+    int fd = -1;
+    int width, height, stride;
+    int keyframe_interval;
+    uint64_t offset = 0;
+    uint64_t frames = 0;
+    bool failed = false;        // a write fell short, nothing more is appended
+    std::vector< char > previous;
+    std::vector< recording::IndexEntry > keyframes;
+    std::string out;
+
+    static void put_varint(std::string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out += (char)(v | 0x80);
+            v >>= 7;
+        }
+        out += (char)v;
+    }
+
+    // record header, payload and an optional tail in one write; after a
+    // failed or short write nothing else is appended, not even the index,
+    // so the file ends at the cut and Replay reads up to it
+    void append(uint32_t kind, const void* payload, size_t size, const void* tail = nullptr, size_t tail_size = 0) {
+        if (failed) return;
+        recording::Record record = {kind, (uint32_t)size};
+        iovec iov[3] = {{&record, sizeof(record)}, {(void*)payload, size}, {(void*)tail, tail_size}};
+        ssize_t total = sizeof(record) + size + (tail ? tail_size : 0);
+        if (::writev(fd, iov, tail ? 3 : 2) != total) {
+            failed = true;
+            return;
+        }
+        offset += sizeof(record) + size;
+    }
+
+    // Changed runs of row y; unchanged gaps shorter than a run header
+    // are sent as part of the run.
+    void encode_row(const char* cur, const char* prev, int y, size_t& last) {
+        const int gap = 4;
+        int x = 0;
+        while (x < width) {
+            while (x < width && cur[x] == prev[x]) x++;
+            if (x == width) break;
+            int start = x;
+            int end = x + 1;
+            for (x = end; x < width && x - end < gap; x++) {
+                if (cur[x] != prev[x]) end = x + 1;
+            }
+            size_t at = (size_t)y * stride + start;
+            put_varint(out, at - last);
+            put_varint(out, end - start);
+            out.append(cur + start, end - start);
+            last = at + (end - start);
+            x = end;
+        }
+    }
+public:
+    Recorder(const char* path, int width, int height, int keyframe_interval = 100):
+        width(width), height(height), stride(width + 1), keyframe_interval(keyframe_interval) {
+        fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (fd < 0) return;
+        recording::Header header = {{}, 1, (uint32_t)width, (uint32_t)height, (uint32_t)keyframe_interval, 0};
+        std::memcpy(header.magic, recording::magic, 4);
+        if (::write(fd, &header, sizeof(header)) == sizeof(header)) offset = sizeof(header);
+        else failed = true;
+    }
+
+    ~Recorder() {
+        close();
+    }
+
+    bool is_open() const { return fd >= 0; }
+    uint64_t frame_count() const { return frames; }
+    uint64_t bytes_written() const { return offset; }
+
+    // Appends the frame as a keyframe or as a delta against the last one.
+    void add(const CharFrame& frame) {
+        if (fd < 0 || failed) return;
+        size_t size = frame.size();
+        const char* bytes = frame.bytes();
+
+        bool key = previous.empty() || frames % keyframe_interval == 0;
+        if (!key) {
+            out.clear();
+            size_t last = 0;
+            for (int y=0; y<height; y++) {
+                encode_row(bytes + (size_t)y * stride, previous.data() + (size_t)y * stride, y, last);
+            }
+            // a delta bigger than the frame itself is not worth it
+            key = out.size() >= size;
+        }
+
+        if (key) {
+            keyframes.push_back({frames, offset});
+            append(recording::KEY, bytes, size);
+        }
+        else append(recording::DELTA, out.data(), out.size());
+
+        previous.assign(bytes, bytes + size);
+        frames++;
+    }
+
+    // Writes the keyframe index and the trailer and closes the file.
+    void close() {
+        if (fd < 0) return;
+        recording::Trailer trailer = {offset, frames, {}};
+        std::memcpy(trailer.magic, recording::trailer_magic, 8);
+        append(recording::INDEX, keyframes.data(), keyframes.size() * sizeof(recording::IndexEntry), &trailer, sizeof(trailer));
+        ::close(fd);
+        fd = -1;
+    }
+};
+
+// Plays a recording from a read-only mapping of the file. Frames go to the
+// descriptor with writev straight out of the mapping: a keyframe is one
+// buffer, a delta a cursor sequence per run plus the run itself.
+class Replay {
+    int fd = -1;
+    const char* data = nullptr;
+    size_t mapped = 0;
+    recording::Header header = {};
+    int stride = 0;
+
+    std::vector< recording::IndexEntry > keyframes;
+    uint64_t frames = 0;
+
+    uint64_t current = 0;       // next frame to play
+    size_t position = 0;        // its record
+    std::vector< char > screen; // frame rebuilt by seek(), sent in full
+    struct Run {
+        size_t cursor, cursor_size;
+        const char* bytes;
+        size_t size;
+    };
+    std::vector< Run > runs;
+    std::vector< char > cursors;
+    std::vector< iovec > iov;
+
+    static uint64_t get_varint(const char*& ptr, const char* end) {
+        uint64_t v = 0;
+        for (int shift=0; ptr < end && shift < 64; shift += 7) {
+            uint8_t byte = *ptr++;
+            v |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        return v;
+    }
+
+    // the record at offset, false past the end or on a cut record
+    bool record_at(size_t offset, recording::Record& record) const {
+        if (offset + sizeof(record) > mapped) return false;
+        std::memcpy(&record, data + offset, sizeof(record));
+        return offset + sizeof(record) + record.size <= mapped;
+    }
+
+    void load_index() {
+        recording::Trailer trailer;
+        if (mapped >= sizeof(header) + sizeof(trailer)) {
+            std::memcpy(&trailer, data + mapped - sizeof(trailer), sizeof(trailer));
+            recording::Record record;
+            if (std::memcmp(trailer.magic, recording::trailer_magic, 8) == 0
+                    && record_at(trailer.index_offset, record) && record.kind == recording::INDEX) {
+                keyframes.resize(record.size / sizeof(recording::IndexEntry));
+                std::memcpy(keyframes.data(), data + trailer.index_offset + sizeof(record), keyframes.size() * sizeof(recording::IndexEntry));
+                frames = trailer.frames;
+                return;
+            }
+        }
+
+        // no trailer: walk the records
+        recording::Record record;
+        for (size_t at=sizeof(header); record_at(at, record); at += sizeof(record) + record.size) {
+            if (record.kind == recording::KEY) keyframes.push_back({frames, at});
+            if (record.kind == recording::KEY || record.kind == recording::DELTA) frames++;
+        }
+    }
+
+    // applies a delta payload to screen
+    void apply(const char* ptr, const char* end) {
+        size_t at = 0;
+        while (ptr < end) {
+            at += get_varint(ptr, end);
+            size_t length = get_varint(ptr, end);
+            if (length > (size_t)(end - ptr) || at + length > screen.size()) return;
+            std::memcpy(screen.data() + at, ptr, length);
+            ptr += length;
+            at += length;
+        }
+    }
+
+    void append_cursor(size_t at) {
+        char seq[32] = "\x1b[";
+        char* ptr = seq + 2;
+        ptr = std::to_chars(ptr, seq + sizeof(seq), at / stride + 1).ptr;
+        *ptr++ = ';';
+        ptr = std::to_chars(ptr, seq + sizeof(seq), at % stride + 1).ptr;
+        *ptr++ = 'H';
+        cursors.insert(cursors.end(), seq, ptr);
+    }
+
+    void write_all(int out) {
+        for (size_t first=0; first<iov.size(); ) {
+            int count = (int)(std::min)(iov.size() - first, (size_t)IOV_MAX);
+            ssize_t written = ::writev(out, iov.data() + first, count);
+            if (written < 0) return;
+            // skip whole buffers, then trim a partly written one
+            while (count > 0 && (size_t)written >= iov[first].iov_len) {
+                written -= iov[first].iov_len;
+                first++;
+                count--;
+            }
+            if (count > 0) {
+                iov[first].iov_base = (char*)iov[first].iov_base + written;
+                iov[first].iov_len -= written;
+            }
+        }
+    }
+public:
+    Replay(const char* path) {
+        fd = ::open(path, O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (::fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(header)) return;
+        mapped = st.st_size;
+        void* map = ::mmap(nullptr, mapped, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) return;
+        data = (const char*)map;
+        ::madvise(map, mapped, MADV_SEQUENTIAL);
+
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, recording::magic, 4) != 0) {
+            ::munmap(map, mapped);
+            data = nullptr;
+            return;
+        }
+        stride = header.width + 1;
+        position = sizeof(header);
+        load_index();
+    }
+
+    ~Replay() {
+        if (data) ::munmap((void*)data, mapped);
+        if (fd >= 0) ::close(fd);
+    }
+
+    bool is_open() const { return data != nullptr; }
+    std::pair<int,int> size() const { return {(int)header.width, (int)header.height}; }
+    uint64_t frame_count() const { return frames; }
+    uint64_t frame() const { return current; }
+
+    // Rebuilds the given frame from the keyframe before it; the next
+    // play() redraws the whole screen.
+    void seek(uint64_t target) {
+        if (keyframes.empty() || target >= frames) return;
+        auto key = std::upper_bound(keyframes.begin(), keyframes.end(), target, [](uint64_t f, const recording::IndexEntry& e) {
+            return f < e.frame;
+        }) - 1;
+
+        screen.assign((size_t)stride * header.height, ' ');
+        size_t at = key->offset;
+        recording::Record record;
+        for (uint64_t f=key->frame; f<=target && record_at(at, record); at += sizeof(record) + record.size) {
+            const char* payload = data + at + sizeof(record);
+            if (record.kind == recording::KEY) std::memcpy(screen.data(), payload, (std::min)((size_t)record.size, screen.size()));
+            else if (record.kind == recording::DELTA) apply(payload, payload + record.size);
+            else continue;
+            f++;
+        }
+        current = target + 1;
+        position = at;
+    }
+
+    // Writes the next frame to out; false at the end of the recording.
+    bool play(int out) {
+        static const char home[] = "\x1b[H";
+        iov.clear();
+        cursors.clear();
+
+        if (!screen.empty()) {
+            iov.push_back({(void*)home, sizeof(home) - 1});
+            iov.push_back({screen.data(), screen.size()});
+            write_all(out);
+            screen.clear();
+            return true;
+        }
+
+        // the index and the trailer follow the last frame
+        if (current >= frames) return false;
+        recording::Record record;
+        while (record_at(position, record) && record.kind != recording::KEY && record.kind != recording::DELTA) {
+            position += sizeof(record) + record.size;
+        }
+        if (!record_at(position, record)) return false;
+
+        const char* payload = data + position + sizeof(record);
+        if (record.kind == recording::KEY) {
+            iov.push_back({(void*)home, sizeof(home) - 1});
+            iov.push_back({(void*)payload, record.size});
+        }
+        else {
+            // cursor sequences go into one buffer first, it must not move
+            // while iov points into it
+            const char* end = payload + record.size;
+            runs.clear();
+            size_t at = 0;
+            for (const char* ptr=payload; ptr<end; ) {
+                at += get_varint(ptr, end);
+                size_t length = (std::min)((size_t)get_varint(ptr, end), (size_t)(end - ptr));
+                size_t cursor = cursors.size();
+                append_cursor(at);
+                runs.push_back({cursor, cursors.size() - cursor, ptr, length});
+                ptr += length;
+                at += length;
+            }
+            for (const Run& run: runs) {
+                iov.push_back({cursors.data() + run.cursor, run.cursor_size});
+                iov.push_back({(void*)run.bytes, run.size});
+            }
+        }
+        position += sizeof(record) + record.size;
+        current++;
+        write_all(out);
+        return true;
+    }
+};
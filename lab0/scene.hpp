@@ -0,0 +1,49 @@
+#pragma once
+
+#include "stream_utils.hpp"
+
+// Сцена лабораторной: два вращающихся треугольника, круг и рамка.
+// Общая для main.cpp и bench.cpp, чтобы измерять ровно то, что рисуется.
+inline void draw_scene(StreamHandler& sh, float t, float t1) {
+    auto size = sh.size();
+    int sizex = size.first;
+    int sizey = size.second;
+
+    float pi = 3.1415;
+    float k = 1;
+
+    {
+        // внешний треугольник
+        float x0, y0, x1, y1, x2, y2;
+        x0 = sizex/2 + k*std::cos(t)*sizex/2;
+        y0 = sizey/2 + k*std::sin(t)*sizey/2;
+        
+        x1 = sizex/2 + k*std::cos(t + 2*pi/3)*sizex/2;
+        y1 = sizey/2 + k*std::sin(t + 2*pi/3)*sizey/2;
+        
+        x2 = sizex/2 + k*std::cos(t + 2*pi*2/3)*sizex/2;
+        y2 = sizey/2 + k*std::sin(t + 2*pi*2/3)*sizey/2;
+        
+        sh.draw_circle((x0 + x1 + x2)/3, (y0 + y1 + y2)/3, 5, 'o');
+        sh.draw_triangle(x0, y0, x1, y1, x2, y2, 'A');
+    }
+    {
+        float x0, y0, x1, y1, x2, y2;
+
+        x0 = sizex/2 + (3.0/2.0 - 1.0/2.0)/std::sqrt(4)*k*std::cos(-t1)*sizex/2;
+        y0 = sizey/2 + (3.0/2.0 - 1.0/2.0)/std::sqrt(4)*k*std::sin(-t1)*sizey/2;
+        
+        x1 = sizex/2 + (3.0/2.0 - 1.0/2.0)/std::sqrt(4)*k*std::cos(-t1 + 2*pi/3)*sizex/2;
+        y1 = sizey/2 + (3.0/2.0 - 1.0/2.0)/std::sqrt(4)*k*std::sin(-t1 + 2*pi/3)*sizey/2;
+        
+        x2 = sizex/2 + (3.0/2.0 - 1.0/2.0)/std::sqrt(4)*k*std::cos(-t1 + 2*pi*2/3)*sizex/2;
+        y2 = sizey/2 + (3.0/2.0 - 1.0/2.0)/std::sqrt(4)*k*std::sin(-t1 + 2*pi*2/3)*sizey/2;
+
+        sh.draw_triangle(x0, y0, x1, y1, x2, y2, 'B');
+    }
+    
+    sh.draw_line(0, 0, 0, sizey-1, '@');
+    sh.draw_line(0, 0, sizex-1, 0, '@');
+    sh.draw_line(sizex-1, 0, sizex-1, sizey-1, '@');
+    sh.draw_line(0, sizey-1, sizex-1, sizey-1, '@');
+}
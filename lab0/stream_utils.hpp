@@ -1,22 +1,1071 @@
+#pragma once
+
 #include <functional>
 #include <fstream>
 #include <vector>
 #include <string>
 #include <cmath>
 #include <cstdlib>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <algorithm>
+#include <memory>
+#include <new>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define min(a, b) (a)>(b) ? (b) : (a) 
 #define max(a, b) (a)<(b) ? (b) : (a) 
 
+// Terminal color: the default one, an entry of the 256-color palette or
+// 24-bit RGB. A cell's colors are packed as fg | bg << 32.
+struct Color {
+    enum Kind { DEFAULT, INDEX, RGB };
+    uint32_t value = 0;
+
+    static Color index(int i) { return {(uint32_t)INDEX << 24 | (i & 0xff)}; }
+    static Color rgb(int r, int g, int b) { return {(uint32_t)RGB << 24 | (r & 0xff) << 16 | (g & 0xff) << 8 | (b & 0xff)}; }
+
+    Kind kind() const { return (Kind)(value >> 24); }
+    bool operator==(const Color& other) const { return value == other.value; }
+
+    static uint64_t pack(Color fg, Color bg) { return fg.value | (uint64_t)bg.value << 32; }
+};
+
+// Character frame: height rows of width chars, each row followed by a
+// '\n' slot, so the whole frame can be sent with one write. Cells written
+// since the last clear are tracked as one column range per row; everything
+// outside them holds the background. Color planes are optional and laid
+// out like the text, one packed fg/bg pair per cell.
+class CharFrame {
+public:
+    struct Extent {
+        int x0, x1;
+    };
+private:
+    static constexpr size_t alignment = 64;
+
+    struct AlignedDelete {
+        void operator()(char* ptr) const { ::operator delete[](ptr, std::align_val_t(alignment)); }
+    };
+
+    std::unique_ptr< char[], AlignedDelete > data;
+    size_t capacity = 0;
+    std::vector< uint64_t > colors;
+    int width = 0, height = 0;
+
+    std::vector< Extent > dirty;
+    int dirty_y0 = 0, dirty_y1 = -1;
+    char fill = ' ';
+public:
+    CharFrame() = default;
+    CharFrame(int width, int height) {
+        resize(width, height);
+    }
+
+    // Reshapes the frame and fills it with the background. The storage is
+    // reused unless the new size doesn't fit, so shrinking and growing
+    // back never allocates.
+    void resize(int width, int height) {
+        this->width = width;
+        this->height = height;
+        size_t bytes = (size() + alignment - 1) / alignment * alignment;
+        if (bytes > capacity) {
+            data.reset(new (std::align_val_t(alignment)) char[bytes]);
+            capacity = bytes;
+        }
+        for (int y=0; y<height; y++) {
+            std::memset(row(y), fill, width);
+            row(y)[width] = '\n';
+        }
+        if (colored()) colors.assign(size(), 0);
+        dirty.assign(height, Extent{width, -1});
+        dirty_y0 = height;
+        dirty_y1 = -1;
+    }
+
+    int stride() const { return width + 1; }
+    size_t size() const { return (size_t)stride() * height; }
+    bool empty() const { return !data; }
+
+    char* row(int y) { return data.get() + (size_t)y * stride(); }
+    const char* row(int y) const { return data.get() + (size_t)y * stride(); }
+    const char* bytes() const { return data.get(); }
+
+    // Adds the color planes, all cells in the default colors.
+    void add_colors() {
+        if (colors.empty()) colors.assign(size(), 0);
+    }
+    bool colored() const { return !colors.empty(); }
+    uint64_t* color_row(int y) { return colors.data() + (size_t)y * stride(); }
+    const uint64_t* color_row(int y) const { return colors.data() + (size_t)y * stride(); }
+
+    // Marks the inclusive rectangle as written; it must lie inside the frame.
+    void touch(int x0, int y0, int x1, int y1) {
+        dirty_y0 = (std::min)(dirty_y0, y0);
+        dirty_y1 = (std::max)(dirty_y1, y1);
+        for (int y=y0; y<=y1; y++) {
+            dirty[y].x0 = (std::min)(dirty[y].x0, x0);
+            dirty[y].x1 = (std::max)(dirty[y].x1, x1);
+        }
+    }
+
+    // x0 > x1 when the row is clean
+    Extent extent(int y) const { return dirty[y]; }
+    int dirty_top() const { return dirty_y0; }
+    int dirty_bottom() const { return dirty_y1; }
+    char background() const { return fill; }
+
+    // Resets the written cells, or the whole frame when the background changes.
+    void clear(char color) {
+        if (color != fill) {
+            fill = color;
+            for (int y=0; y<height; y++) std::memset(row(y), fill, width);
+            std::fill(colors.begin(), colors.end(), 0);
+        }
+        else {
+            for (int y=dirty_y0; y<=dirty_y1; y++) {
+                int x0 = dirty[y].x0, x1 = dirty[y].x1;
+                if (x0 > x1) continue;
+                std::memset(row(y) + x0, fill, x1 - x0 + 1);
+                if (colored()) std::fill(color_row(y) + x0, color_row(y) + x1 + 1, 0);
+            }
+        }
+        for (int y=dirty_y0; y<=dirty_y1; y++) dirty[y] = {width, -1};
+        dirty_y0 = height;
+        dirty_y1 = -1;
+    }
+
+    // Takes over the dirty state of a frame whose cells this one now mirrors.
+    void copy_dirty(const CharFrame& other) {
+        dirty = other.dirty;
+        dirty_y0 = other.dirty_y0;
+        dirty_y1 = other.dirty_y1;
+        fill = other.fill;
+    }
+};
+
+// Persistent worker threads. run(n, job) calls job(i) for every i in
+// [0, n) on the workers and the calling thread, and returns when all are done.
+class WorkerPool {
+    std::vector< std::thread > threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+
+    std::function< void(int) > job;
+    int jobs = 0;
+    std::atomic<int> next{0};
+    size_t finished = 0;
+    int generation = 0;
+    bool stopping = false;
+
+    void drain() {
+        for (int i = next.fetch_add(1); i < jobs; i = next.fetch_add(1)) {
+            job(i);
+        }
+    }
+
+    void worker() {
+        int seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&]{ return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+
+            lock.unlock();
+            drain();
+            lock.lock();
+
+            if (++finished == threads.size()) done.notify_one();
+        }
+    }
+public:
+    WorkerPool(int count) {
+        for (int i=1; i<count; i++) {
+            threads.emplace_back(&WorkerPool::worker, this);
+        }
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread: threads) thread.join();
+    }
+
+    int size() const { return threads.size() + 1; }
+
+    void run(int count, std::function< void(int) > task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = std::move(task);
+            jobs = count;
+            next = 0;
+            finished = 0;
+            generation++;
+        }
+        wake.notify_all();
+        drain();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]{ return finished == threads.size(); });
+    }
+};
+
 class StreamHandler {
+    friend class SubcellCanvas;
+
     int width, height;
     float Wh_koef = 1;
     std::reference_wrapper< std::ostream > stream;
-    std::vector< std::string > buffer; 
+    int fd = -1;
+
+    // frames[0] is the canvas; with the writer thread running the three
+    // frames rotate between drawing (buffer), the handoff slot and output
+    CharFrame frames[3];
+    CharFrame* buffer = &frames[0];
+
+    // last frame sent by flush_diff(); the next one is a full redraw while
+    // redraw is set
+    CharFrame previous;
+    bool redraw = true;
+    std::string out;
+    uint64_t sgr = 0;       // terminal colors while encoding
+    bool stats_line = false;
+    std::atomic<size_t> flushed_bytes{0};
+    std::atomic<int> flushed_writes{0};
+
+    // Handoff slot: index of the frame waiting for the writer, plus flags.
+    // The renderer swaps its finished frame in, the writer swaps its spent
+    // one in, so neither side ever waits on a lock. SLOT_PAUSE asks the
+    // writer to park between frames and SLOT_PAUSED is its answer.
+    static constexpr unsigned SLOT_INDEX = 3, SLOT_FRESH = 4, SLOT_STOP = 8;
+    static constexpr unsigned SLOT_PAUSE = 16, SLOT_PAUSED = 32;
+    std::atomic<unsigned> slot{0};
+    std::thread writer;
+    int drop_policy = 0;
+    std::atomic<long> presented{0}, written{0}, dropped{0};
+
+    // inclusive cell rectangle the rasterizers are allowed to write into
+    struct Rect {
+        int x0, y0, x1, y1;
+    };
+    Rect canvas() const { return {0, 0, width - 1, height - 1}; }
+
+    // what the rasterizers write into a cell
+    struct Brush {
+        char glyph;
+        uint64_t colors;
+    };
+    bool colored = false;
+    uint64_t pen = 0;
+
+    // UTF-8 form of every cell mask in a sub-cell mode, null for text
+    struct Utf8 {
+        char bytes[3];
+        uint8_t size;
+    };
+    const Utf8* glyph_table = nullptr;
+
+    // Deferred mode: draw calls are recorded and rasterized by submit(),
+    // tile by tile on the worker pool. Every rasterizer produces the same
+    // cells whatever the clip rectangle, so the result matches serial drawing.
+    struct Command {
+        enum Type { POINT, LINE, TRIANGLE, FILLED_TRIANGLE, ELLIPSE, FILLED_ELLIPSE } type;
+        float v[6];
+        Brush brush;
+    };
+    static constexpr int tile_width = 128;
+    static constexpr int tile_height = 64;
+
+    bool deferred = false;
+    std::unique_ptr< WorkerPool > pool;
+    std::vector< Command > commands;
+    // commands per tile, binned by a counting sort into one array: tile t
+    // holds binned[bin_end[t - 1] .. bin_end[t])
+    std::vector< Rect > boxes;
+    std::vector< int > bin_end;
+    std::vector< int > binned;
+
+    static int cell_floor(float v, int limit) {
+        if (!(v > -1)) return -1;
+        if (!(v < limit)) return limit;
+        return (int)std::floor(v);
+    }
+
+    // conservative cell bounds of a command, before canvas clipping
+    Rect bounds(const Command& cmd) const {
+        float minx = cmd.v[0], maxx = cmd.v[0];
+        float miny = cmd.v[1], maxy = cmd.v[1];
+        bool ellipse = cmd.type == Command::ELLIPSE || cmd.type == Command::FILLED_ELLIPSE;
+        int points = cmd.type == Command::POINT || ellipse ? 1
+                   : cmd.type == Command::LINE ? 2 : 3;
+        for (int i=1; i<points; i++) {
+            minx = (std::min)(minx, cmd.v[2*i]); maxx = (std::max)(maxx, cmd.v[2*i]);
+            miny = (std::min)(miny, cmd.v[2*i+1]); maxy = (std::max)(maxy, cmd.v[2*i+1]);
+        }
+        float padx = ellipse ? std::abs(cmd.v[2]) + 1 : 1;
+        float pady = ellipse ? std::abs(cmd.v[3]) + 1 : 1;
+        return {
+            cell_floor(minx - padx, width), cell_floor(miny - pady, height),
+            cell_floor(maxx + padx, width), cell_floor(maxy + pady, height)
+        };
+    }
+
+    void execute(const Command& cmd, const Rect& clip) {
+        const float* v = cmd.v;
+        switch (cmd.type) {
+            case Command::POINT: plot(v[0], v[1], cmd.brush, clip); break;
+            case Command::LINE: raster_line(v[0], v[1], v[2], v[3], cmd.brush, clip); break;
+            case Command::TRIANGLE:
+                raster_line(v[0], v[1], v[2], v[3], cmd.brush, clip);
+                raster_line(v[2], v[3], v[4], v[5], cmd.brush, clip);
+                raster_line(v[4], v[5], v[0], v[1], cmd.brush, clip);
+                break;
+            case Command::FILLED_TRIANGLE: raster_triangle(v[0], v[1], v[2], v[3], v[4], v[5], cmd.brush, clip); break;
+            case Command::ELLIPSE: raster_ellipse(v[0], v[1], v[2], v[3], false, cmd.brush, clip); break;
+            case Command::FILLED_ELLIPSE: raster_ellipse(v[0], v[1], v[2], v[3], true, cmd.brush, clip); break;
+        }
+    }
+
+    // marks the cells a command may write as dirty in the canvas
+    void touch(const Command& cmd) {
+        Rect box = bounds(cmd);
+        box.x0 = (std::max)(box.x0, 0); box.x1 = (std::min)(box.x1, width - 1);
+        box.y0 = (std::max)(box.y0, 0); box.y1 = (std::min)(box.y1, height - 1);
+        if (box.x0 <= box.x1 && box.y0 <= box.y1) buffer->touch(box.x0, box.y0, box.x1, box.y1);
+    }
+
+    // Records the command in deferred mode, rasterizes it otherwise.
+    void issue(Command::Type type, std::initializer_list<float> v, char color) {
+        Command cmd;
+        cmd.type = type;
+        cmd.brush = {color, pen};
+        std::copy(v.begin(), v.end(), cmd.v);
+        if (deferred) {
+            commands.push_back(cmd);
+            return;
+        }
+        touch(cmd);
+        execute(cmd, canvas());
+    }
+
+    static char* put_number(char* ptr, int value) {
+        char digits[12];
+        int count = 0;
+        do {
+            digits[count++] = '0' + value % 10;
+            value /= 10;
+        } while (value > 0);
+        while (count > 0) *ptr++ = digits[--count];
+        return ptr;
+    }
+
+    void append_cursor(int x, int y) {
+        char seq[32] = "\x1b[";
+        char* ptr = put_number(seq + 2, y + 1);
+        *ptr++ = ';';
+        ptr = put_number(ptr, x + 1);
+        *ptr++ = 'H';
+        out.append(seq, ptr - seq);
+    }
+
+    // SGR sequence switching the terminal colors from one packed pair to another
+    void append_sgr(uint64_t from, uint64_t to) {
+        char seq[48] = "\x1b[";
+        char* ptr = seq + 2;
+        for (int layer=0; layer<2; layer++) {
+            Color a{(uint32_t)(from >> 32*layer)}, b{(uint32_t)(to >> 32*layer)};
+            if (a == b) continue;
+            if (ptr != seq + 2) *ptr++ = ';';
+
+            int base = layer ? 40 : 30;
+            switch (b.kind()) {
+                case Color::DEFAULT:
+                    ptr = put_number(ptr, base + 9);
+                    break;
+                case Color::INDEX:
+                    ptr = put_number(ptr, base + 8);
+                    ptr = std::copy_n(";5;", 3, ptr);
+                    ptr = put_number(ptr, b.value & 0xff);
+                    break;
+                case Color::RGB:
+                    ptr = put_number(ptr, base + 8);
+                    ptr = std::copy_n(";2;", 3, ptr);
+                    ptr = put_number(ptr, b.value >> 16 & 0xff);
+                    *ptr++ = ';';
+                    ptr = put_number(ptr, b.value >> 8 & 0xff);
+                    *ptr++ = ';';
+                    ptr = put_number(ptr, b.value & 0xff);
+                    break;
+            }
+        }
+        *ptr++ = 'm';
+        out.append(seq, ptr - seq);
+    }
+
+    // Braille masks are the dot patterns of U+2800..U+28FF, half-block
+    // masks are bit 0 for the upper and bit 1 for the lower half.
+    static const Utf8* make_glyph_table(int glyphs) {
+        static const std::vector< Utf8 > tables = [] {
+            std::vector< Utf8 > t(512);
+            const char halves[4] = {0, '\x80', '\x84', '\x88'};
+            for (int m=0; m<256; m++) {
+                if (m & 3) t[m] = {{'\xe2', '\x96', halves[m & 3]}, 3};
+                else t[m] = {{' '}, 1};
+                t[256 + m] = {{'\xe2', (char)(0xa0 | m >> 6), (char)(0x80 | (m & 0x3f))}, 3};
+            }
+            // an empty cell is a space, not the three-byte blank pattern
+            t[256] = t[0];
+            return t;
+        }();
+        if (glyphs == TEXT) return nullptr;
+        return tables.data() + (glyphs == BRAILLE ? 256 : 0);
+    }
+
+    void append_text(const char* text, int x0, int x1) {
+        if (!glyph_table) {
+            out.append(text + x0, x1 - x0);
+            return;
+        }
+        size_t at = out.size();
+        out.resize(at + 3*(x1 - x0));
+        char* ptr = &out[at];
+        for (int x=x0; x<x1; x++) {
+            const Utf8& glyph = glyph_table[(unsigned char)text[x]];
+            std::memcpy(ptr, glyph.bytes, 3);
+            ptr += glyph.size;
+        }
+        out.resize(ptr - out.data());
+    }
+
+    // Cells [x0, x1) of a row. A color change costs one SGR sequence, the
+    // cells in between go out as plain text.
+    void append_cells(const CharFrame& frame, int y, int x0, int x1) {
+        const char* text = frame.row(y);
+        if (!frame.colored()) {
+            append_text(text, x0, x1);
+            return;
+        }
+
+        const uint64_t* colors = frame.color_row(y);
+        while (x0 < x1) {
+            uint64_t cell = colors[x0];
+            if (cell != sgr) {
+                append_sgr(sgr, cell);
+                sgr = cell;
+            }
+            int end = x0 + 1;
+            while (end < x1 && colors[end] == cell) end++;
+            append_text(text, x0, end);
+            x0 = end;
+        }
+    }
+
+    void reset_sgr() {
+        if (sgr) append_sgr(sgr, 0);
+        sgr = 0;
+    }
+
+    // Sends prefix + body as a single write (writev on a raw descriptor).
+    void write_out(const char* prefix, size_t prefix_size, const char* body, size_t body_size) {
+        flushed_bytes = prefix_size + body_size;
+#ifndef _WIN32
+        if (fd >= 0) {
+            iovec iov[2] = {
+                {(void*)prefix, prefix_size},
+                {(void*)body, body_size}
+            };
+            int first = prefix_size ? 0 : 1;
+            size_t left = prefix_size + body_size;
+            int writes = 0;
+            while (left > 0) {
+                ssize_t count = ::writev(fd, iov + first, 2 - first);
+                writes++;
+                if (count < 0) break;
+
+                left -= count;
+                while (first < 2 && (size_t)count >= iov[first].iov_len) {
+                    count -= iov[first].iov_len;
+                    first++;
+                }
+                if (first < 2) {
+                    iov[first].iov_base = (char*)iov[first].iov_base + count;
+                    iov[first].iov_len -= count;
+                }
+            }
+            flushed_writes = writes;
+            return;
+        }
+#endif
+        stream.get().write(prefix, prefix_size);
+        stream.get().write(body, body_size);
+        stream.get().flush();
+        flushed_writes = 1;
+    }
+
+    // first x in [from, to) where the rows differ, or to
+    static int mismatch(const char* a, const char* b, int from, int to) {
+        for (; from + 8 <= to; from += 8) {
+            uint64_t wa, wb;
+            std::memcpy(&wa, a + from, 8);
+            std::memcpy(&wb, b + from, 8);
+            if (wa != wb) return from + __builtin_ctzll(wa ^ wb) / 8;
+        }
+        while (from < to && a[from] == b[from]) from++;
+        return from;
+    }
+
+    // Changed runs of frame against previous, as CUP-addressed text in out.
+    // Unchanged gaps shorter than a cursor sequence are sent as-is. Only the
+    // dirty extents of the two frames are compared.
+    void encode_diff(const CharFrame& frame) {
+        const int gap = 8;
+        out.clear();
+
+        if (redraw) {
+            redraw = false;
+            previous.resize(width, height);
+            out += "\x1b[2J";
+            for (int y=0; y<height; y++) {
+                append_cursor(0, y);
+                append_cells(frame, y, 0, width);
+                std::memcpy(previous.row(y), frame.row(y), width);
+            }
+            if (frame.colored()) {
+                previous.add_colors();
+                for (int y=0; y<height; y++) std::copy_n(frame.color_row(y), width, previous.color_row(y));
+            }
+        }
+        else {
+            if (frame.colored()) previous.add_colors();
+            bool whole = frame.background() != previous.background();
+            int top = whole ? 0 : (std::min)(frame.dirty_top(), previous.dirty_top());
+            int bottom = whole ? height - 1 : (std::max)(frame.dirty_bottom(), previous.dirty_bottom());
+            for (int y=top; y<=bottom; y++) {
+                CharFrame::Extent a = frame.extent(y), b = previous.extent(y);
+                int lo = whole ? 0 : (std::min)(a.x0, b.x0);
+                int hi = whole ? width - 1 : (std::max)(a.x1, b.x1);
+                if (lo > hi) continue;
+
+                const char* cur = frame.row(y);
+                char* prev = previous.row(y);
+                const uint64_t* cur_colors = frame.colored() ? frame.color_row(y) : nullptr;
+                uint64_t* prev_colors = frame.colored() ? previous.color_row(y) : nullptr;
+                auto differs = [&](int x) {
+                    return cur[x] != prev[x] || (cur_colors && cur_colors[x] != prev_colors[x]);
+                };
+
+                int x = lo;
+                while (true) {
+                    int found = mismatch(cur, prev, x, hi + 1);
+                    if (cur_colors) {
+                        while (x < found && cur_colors[x] == prev_colors[x]) x++;
+                        found = x;
+                    }
+                    if ((x = found) > hi) break;
+
+                    int start = x;
+                    int end = x + 1;
+                    int same = 0;
+                    for (x = end; x <= hi && same < gap; x++) {
+                        if (differs(x)) {
+                            end = x + 1;
+                            same = 0;
+                        }
+                        else same++;
+                    }
+
+                    append_cursor(start, y);
+                    append_cells(frame, y, start, end);
+                    std::memcpy(prev + start, cur + start, end - start);
+                    if (cur_colors) std::copy(cur_colors + start, cur_colors + end, prev_colors + start);
+                    x = end;
+                }
+            }
+        }
+
+        previous.copy_dirty(frame);
+        reset_sgr();
+
+        append_cursor(0, height);
+        if (stats_line) {
+            // this frame's bytes so far; write_out() only sets flushed_bytes
+            // once it is sent, so that would be the previous frame's
+            size_t bytes = out.size();
+            out += "bytes/frame: ";
+            out += std::to_string(bytes);
+            out += "  dropped: ";
+            out += std::to_string(dropped);
+            out += "\x1b[K";
+        }
+    }
+
+    // Colored frames and masks can't go out as raw bytes: every row is
+    // encoded with its color runs and ends in the default colors.
+    void encode_full(const CharFrame& frame) {
+        out.clear();
+        for (int y=0; y<height; y++) {
+            append_cells(frame, y, 0, width);
+            reset_sgr();
+            out += '\n';
+        }
+    }
+
+    void send(const CharFrame& frame, int mode) {
+        static const char ansi_prefix[] = "\x1b[3";
+        switch (mode) {
+            case FULL:
+            case ANSI: {
+                size_t prefix_size = mode == ANSI ? sizeof(ansi_prefix) - 1 : 0;
+                if (frame.colored() || glyph_table) {
+                    encode_full(frame);
+                    write_out(ansi_prefix, prefix_size, out.data(), out.size());
+                }
+                else write_out(ansi_prefix, prefix_size, frame.bytes(), frame.size());
+                break;
+            }
+            case DIFF:
+                encode_diff(frame);
+                write_out(nullptr, 0, out.data(), out.size());
+                break;
+        }
+    }
+
+    void write_loop(int mode, unsigned front) {
+        while (true) {
+            unsigned current = slot.load(std::memory_order_acquire);
+            if (current & SLOT_PAUSE) {
+                if (!(current & SLOT_PAUSED)) {
+                    if (!slot.compare_exchange_weak(current, current | SLOT_PAUSED, std::memory_order_acq_rel)) continue;
+                    current |= SLOT_PAUSED;
+                    slot.notify_all();
+                }
+                slot.wait(current);
+                continue;
+            }
+            if (!(current & SLOT_FRESH)) {
+                if (current & SLOT_STOP) return;
+                slot.wait(current);
+                continue;
+            }
+            unsigned spent = front | (current & SLOT_STOP);
+            if (!slot.compare_exchange_weak(current, spent, std::memory_order_acq_rel)) continue;
+            slot.notify_all();
+
+            front = current & SLOT_INDEX;
+            send(frames[front], mode);
+            written++;
+        }
+    }
+
+    // Upper bound of encode_diff() output for the canvas: a cursor per run,
+    // runs at least a gap apart, and an SGR change before every cell.
+    size_t max_encoded_size() const {
+        size_t cell = (glyph_table ? 3 : 1) + (colored ? 48 : 0);
+        size_t row = 16*((size_t)width/8 + 1) + cell*width;
+        return 128 + row*height;
+    }
+
+    // Returns once the writer is parked between frames and touches none.
+    void pause_writer() {
+        slot.fetch_or(SLOT_PAUSE, std::memory_order_acq_rel);
+        slot.notify_all();
+        unsigned current;
+        while (!((current = slot.load(std::memory_order_acquire)) & SLOT_PAUSED)) {
+            slot.wait(current);
+        }
+    }
+
+    // A frame still waiting in the slot is dropped: it has the old size.
+    void resume_writer() {
+        unsigned current = slot.load(std::memory_order_acquire);
+        if (current & SLOT_FRESH) dropped++;
+        slot.store(current & SLOT_INDEX, std::memory_order_release);
+        slot.notify_all();
+    }
+
+    // Liang-Barsky: cuts the segment to the rectangle, false if nothing is left
+    static bool clip_segment(
+        float& x0, float& y0, float& x1, float& y1,
+        float xmin, float ymin, float xmax, float ymax
+    ) {
+        float dx = x1 - x0;
+        float dy = y1 - y0;
+        float p[4] = {-dx, dx, -dy, dy};
+        float q[4] = {x0 - xmin, xmax - x0, y0 - ymin, ymax - y0};
+
+        float t0 = 0, t1 = 1;
+        for (int i=0; i<4; i++) {
+            if (p[i] == 0) {
+                if (q[i] < 0) return false;
+                continue;
+            }
+            float t = q[i] / p[i];
+            if (p[i] < 0) {
+                if (t > t1) return false;
+                if (t > t0) t0 = t;
+            }
+            else {
+                if (t < t0) return false;
+                if (t < t1) t1 = t;
+            }
+        }
+
+        float sx = x0, sy = y0;
+        x0 = sx + t0*dx; y0 = sy + t0*dy;
+        x1 = sx + t1*dx; y1 = sy + t1*dy;
+        return true;
+    }
+
+    // cells x0..x1 of row y, already clipped
+    void fill_span(int y, int x0, int x1, Brush brush) {
+        std::memset(buffer->row(y) + x0, brush.glyph, x1 - x0 + 1);
+        if (colored) std::fill_n(buffer->color_row(y) + x0, x1 - x0 + 1, brush.colors);
+    }
+
+    void plot(int x, int y, Brush brush, const Rect& clip) {
+        if (x < clip.x0 || x > clip.x1 || y < clip.y0 || y > clip.y1) return;
+        buffer->row(y)[x] = brush.glyph;
+        if (colored) buffer->color_row(y)[x] = brush.colors;
+    }
+
+    void plot(float xf, float yf, Brush brush, const Rect& clip) {
+        if (!(std::abs(xf) < guard_band) || !(std::abs(yf) < guard_band)) return;
+        plot((int)std::lround(xf), (int)std::lround(yf), brush, clip);
+    }
+
+    static long long floor_div(long long a, long long b) {
+        return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+    }
+
+    void raster_line(float fx0, float fy0, float fx1, float fy1, Brush brush, const Rect& clip) {
+        if (!std::isfinite(fx0) || !std::isfinite(fy0) || !std::isfinite(fx1) || !std::isfinite(fy1)) return;
+        if (!clip_segment(fx0, fy0, fx1, fy1, -0.5f, -0.5f, width - 0.5f, height - 0.5f)) return;
+
+        int x0 = std::clamp((int)std::lround(fx0), 0, width - 1);
+        int y0 = std::clamp((int)std::lround(fy0), 0, height - 1);
+        int x1 = std::clamp((int)std::lround(fx1), 0, width - 1);
+        int y1 = std::clamp((int)std::lround(fy1), 0, height - 1);
+
+        if (y0 == y1) {
+            if (y0 < clip.y0 || y0 > clip.y1) return;
+            if (x0 > x1) std::swap(x0, x1);
+            x0 = (std::max)(x0, clip.x0);
+            x1 = (std::min)(x1, clip.x1);
+            if (x0 <= x1) fill_span(y0, x0, x1, brush);
+            return;
+        }
+        if (x0 == x1) {
+            if (x0 < clip.x0 || x0 > clip.x1) return;
+            if (y0 > y1) std::swap(y0, y1);
+            y0 = (std::max)(y0, clip.y0);
+            y1 = (std::min)(y1, clip.y1);
+            for (int y=y0; y<=y1; y++) {
+                buffer->row(y)[x0] = brush.glyph;
+                if (colored) buffer->color_row(y)[x0] = brush.colors;
+            }
+            return;
+        }
+
+        // walk the major axis; minor offset after k steps is
+        // round(k*dminor/dmajor), kept as quotient + remainder
+        bool steep = std::abs(y1 - y0) > std::abs(x1 - x0);
+        if (steep ? y0 > y1 : x0 > x1) {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+        }
+
+        int dmajor = steep ? y1 - y0 : x1 - x0;
+        int dminor = steep ? x1 - x0 : y1 - y0;
+        int dir = 1;
+        if (dminor < 0) {
+            dminor = -dminor;
+            dir = -1;
+        }
+
+        // only the steps that land inside the clip: the major coordinate
+        // bounds k directly, the minor offset q(k) is monotonic in k
+        int major0 = steep ? y0 : x0;
+        int minor0 = steep ? x0 : y0;
+        int kmin = (std::max)(0, (steep ? clip.y0 : clip.x0) - major0);
+        int kmax = (std::min)(dmajor, (steep ? clip.y1 : clip.x1) - major0);
+
+        int minor_lo = steep ? clip.x0 : clip.y0;
+        int minor_hi = steep ? clip.x1 : clip.y1;
+        long long qmin = dir > 0 ? minor_lo - minor0 : minor0 - minor_hi;
+        long long qmax = dir > 0 ? minor_hi - minor0 : minor0 - minor_lo;
+        kmin = (int)(std::max)((long long)kmin, -floor_div(dmajor - 2*dmajor*qmin, 2*dminor));
+        kmax = (int)(std::min)((long long)kmax, floor_div(2*dmajor*(qmax + 1) - dmajor - 1, 2*dminor));
+        if (kmin > kmax) return;
+
+        long long start = 2LL*kmin*dminor + dmajor;
+        int minor = minor0 + dir * (int)(start / (2*dmajor));
+        int error = (int)(start % (2*dmajor));
+
+        int stride = buffer->stride();
+        int major_step = steep ? stride : 1;
+        int minor_step = (steep ? 1 : stride) * dir;
+        // one offset addresses the text and the color plane alike
+        char* text = buffer->row(0);
+        uint64_t* colors = colored ? buffer->color_row(0) : nullptr;
+        long long at = (long long)(steep ? major0 + kmin : minor) * stride + (steep ? minor : major0 + kmin);
+        for (int k=kmin; k<=kmax; k++) {
+            text[at] = brush.glyph;
+            if (colors) colors[at] = brush.colors;
+            at += major_step;
+            error += 2*dminor;
+            if (error >= 2*dmajor) {
+                error -= 2*dmajor;
+                at += minor_step;
+            }
+        }
+    }
+
+    // Edge function setup for the filled triangle rasterizer. Vertices are
+    // snapped to 1/16 of a cell, cells are sampled at their centers.
+    static constexpr int subpixel_bits = 4;
+    static constexpr int block_size = 8;
+    static constexpr float guard_band = 65536.0f;
+
+    struct Edge {
+        long long c;          // value at cell (0, 0)
+        int step_x, step_y;   // change per cell
+        int bias;             // 0 on top-left edges, -1 elsewhere
+
+        Edge(long long ax, long long ay, long long bx, long long by) {
+            long long dx = bx - ax;
+            long long dy = by - ay;
+            c = dx * (-ay) - dy * (-ax);
+            step_x = (int)(-dy << subpixel_bits);
+            step_y = (int)(dx << subpixel_bits);
+            bool top = dy == 0 && dx > 0;
+            bool left = dy < 0;
+            bias = (top || left) ? 0 : -1;
+        }
+
+        long long at(int x, int y) const {
+            return c + (long long)step_x * x + (long long)step_y * y;
+        }
+    };
+
+    // Bit i set when cell x+i of the row is inside all edges. e holds the
+    // biased edge values at cell x; inactive edges are masked to zero.
+    static unsigned row_coverage(const int e[3], const int step[3], const int active[3], unsigned valid) {
+#if defined(__AVX2__)
+        const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256i outside = _mm256_setzero_si256();
+        for (int i=0; i<3; i++) {
+            __m256i v = _mm256_add_epi32(_mm256_set1_epi32(e[i]), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(step[i])));
+            outside = _mm256_or_si256(outside, _mm256_and_si256(v, _mm256_set1_epi32(active[i])));
+        }
+        unsigned mask = _mm256_movemask_ps(_mm256_castsi256_ps(outside));
+#elif defined(__SSE2__)
+        __m128i outside_lo = _mm_setzero_si128();
+        __m128i outside_hi = _mm_setzero_si128();
+        for (int i=0; i<3; i++) {
+            __m128i act = _mm_set1_epi32(active[i]);
+            __m128i lo = _mm_setr_epi32(e[i], e[i] + step[i], e[i] + 2*step[i], e[i] + 3*step[i]);
+            __m128i hi = _mm_add_epi32(lo, _mm_set1_epi32(4*step[i]));
+            outside_lo = _mm_or_si128(outside_lo, _mm_and_si128(lo, act));
+            outside_hi = _mm_or_si128(outside_hi, _mm_and_si128(hi, act));
+        }
+        unsigned mask = _mm_movemask_ps(_mm_castsi128_ps(outside_lo)) | (_mm_movemask_ps(_mm_castsi128_ps(outside_hi)) << 4);
+#else
+        unsigned mask = 0;
+        for (int lane=0; lane<block_size; lane++) {
+            int v = 0;
+            for (int i=0; i<3; i++) v |= (e[i] + lane*step[i]) & active[i];
+            if (v < 0) mask |= 1u << lane;
+        }
+#endif
+        return ~mask & valid;
+    }
+
+    void raster_triangle(float fx0, float fy0, float fx1, float fy1, float fx2, float fy2, Brush brush, const Rect& clip) {
+        float coords[6] = {fx0, fy0, fx1, fy1, fx2, fy2};
+        long long v[6];
+        for (int i=0; i<6; i++) {
+            if (!(std::abs(coords[i]) < guard_band)) return;
+            v[i] = std::lround(coords[i] * (1 << subpixel_bits));
+        }
+
+        long long area = (v[2] - v[0]) * (v[5] - v[1]) - (v[3] - v[1]) * (v[4] - v[0]);
+        if (area == 0) return;
+        if (area < 0) {
+            std::swap(v[2], v[4]);
+            std::swap(v[3], v[5]);
+        }
+
+        long long fminx = (std::min)({v[0], v[2], v[4]});
+        long long fmaxx = (std::max)({v[0], v[2], v[4]});
+        long long fminy = (std::min)({v[1], v[3], v[5]});
+        long long fmaxy = (std::max)({v[1], v[3], v[5]});
+
+        const int one = 1 << subpixel_bits;
+        int minx = (int)(std::max)((fminx + one - 1) >> subpixel_bits, (long long)clip.x0);
+        int miny = (int)(std::max)((fminy + one - 1) >> subpixel_bits, (long long)clip.y0);
+        int maxx = (int)(std::min)(fmaxx >> subpixel_bits, (long long)clip.x1);
+        int maxy = (int)(std::min)(fmaxy >> subpixel_bits, (long long)clip.y1);
+        if (minx > maxx || miny > maxy) return;
+
+        Edge edges[3] = {
+            Edge(v[0], v[1], v[2], v[3]),
+            Edge(v[2], v[3], v[4], v[5]),
+            Edge(v[4], v[5], v[0], v[1]),
+        };
+        int step_x[3] = {edges[0].step_x, edges[1].step_x, edges[2].step_x};
+
+        for (int by=miny; by<=maxy; by+=block_size) {
+            int bye = (std::min)(by + block_size - 1, maxy);
+            for (int bx=minx; bx<=maxx; bx+=block_size) {
+                int bxe = (std::min)(bx + block_size - 1, maxx);
+
+                bool rejected = false;
+                int inside = 0;
+                int e[3], active[3];
+                for (int i=0; i<3 && !rejected; i++) {
+                    const Edge& edge = edges[i];
+                    long long c00 = edge.at(bx, by) + edge.bias;
+                    long long c10 = edge.at(bxe, by) + edge.bias;
+                    long long c01 = edge.at(bx, bye) + edge.bias;
+                    long long c11 = edge.at(bxe, bye) + edge.bias;
+
+                    long long lo = (std::min)({c00, c10, c01, c11});
+                    long long hi = (std::max)({c00, c10, c01, c11});
+                    if (hi < 0) rejected = true;
+                    else if (lo >= 0) {
+                        inside++;
+                        e[i] = 0;
+                        active[i] = 0;
+                    }
+                    else {
+                        e[i] = (int)c00;
+                        active[i] = -1;
+                    }
+                }
+                if (rejected) continue;
+
+                if (inside == 3) {
+                    for (int y=by; y<=bye; y++) {
+                        fill_span(y, bx, bxe, brush);
+                    }
+                    continue;
+                }
+
+                unsigned valid = (1u << (bxe - bx + 1)) - 1;
+                for (int y=by; y<=bye; y++) {
+                    unsigned covered = row_coverage(e, step_x, active, valid);
+                    if (covered) {
+                        int first = __builtin_ctz(covered);
+                        int last = 31 - __builtin_clz(covered);
+                        fill_span(y, bx + first, bx + last, brush);
+                    }
+                    for (int i=0; i<3; i++) e[i] += edges[i].step_y & active[i];
+                }
+            }
+        }
+    }
+
+    static long long isqrt(long long v) {
+        if (v <= 0) return 0;
+        long long r = (long long)std::sqrt((double)v);
+        while (r*r > v) r--;
+        while ((r + 1)*(r + 1) <= v) r++;
+        return r;
+    }
+
+    // Half-width of the midpoint ellipse with radii a, b in row d >= 0, or
+    // -1 past the top. Where the curve is steep the cell is
+    // round(a*sqrt(1 - d^2/b^2)); where it is flat the row reaches the last
+    // column whose round(b*sqrt(1 - x^2/a^2)) is still >= d.
+    static long long ellipse_span(long long a, long long b, long long d) {
+        if (d > b) return -1;
+        if (b == 0) return a;
+        if (a == 0) return 0;
+        long long steep = (isqrt(4*a*a*(b*b - d*d)) / b + 1) / 2;
+        long long flat_sq = 4*a*a*b*b - (2*d - 1)*(2*d - 1)*a*a;
+        long long flat = flat_sq < 0 ? -1 : isqrt(flat_sq) / (2*b);
+        return (std::max)(steep, flat);
+    }
+
+    void span(int y, int x0, int x1, Brush brush, const Rect& clip) {
+        if (y < clip.y0 || y > clip.y1) return;
+        x0 = (std::max)(x0, clip.x0);
+        x1 = (std::min)(x1, clip.x1);
+        if (x0 <= x1) fill_span(y, x0, x1, brush);
+    }
+
+    // Midpoint ellipse as horizontal spans. The outline of row d covers the
+    // cells between the next row's half-width and its own, which gives the
+    // same cells as stepping the midpoint algorithm octant by octant.
+    void raster_ellipse(float x0, float y0, float rx, float ry, bool filled, Brush brush, const Rect& clip) {
+        const float radius_guard = guard_band / 2;
+        if (!(std::abs(x0) < guard_band) || !(std::abs(y0) < guard_band)) return;
+        if (!(rx >= 0 && rx < radius_guard) || !(ry >= 0 && ry < radius_guard)) return;
+        int cx = (int)std::lround(x0);
+        int cy = (int)std::lround(y0);
+        long long a = std::lround(rx);
+        long long b = std::lround(ry);
+
+        int from = (std::max)((long long)clip.y0, cy - b);
+        int to = (std::min)((long long)clip.y1, cy + b);
+        if (from > to) return;
+
+        int d = std::abs(from - cy);
+        long long h = ellipse_span(a, b, d);
+        long long next = ellipse_span(a, b, d + 1);
+        for (int y=from; y<=to; y++) {
+            if (filled) span(y, cx - h, cx + h, brush, clip);
+            else {
+                int inner = (std::min)(next + 1, h);
+                span(y, cx + inner, cx + h, brush, clip);
+                span(y, cx - h, cx - inner, brush, clip);
+            }
+
+            if (y < cy) {
+                next = h;
+                h = ellipse_span(a, b, --d);
+            }
+            else {
+                h = next;
+                next = ellipse_span(a, b, ++d + 1);
+            }
+        }
+    }
 public:
-    StreamHandler(std::ostream& stream, int width, int height): width(width), height(height), stream(stream), buffer(height, std::string(width, ' ')) {
+    enum FlushMode { FULL, ANSI, DIFF };
+
+    // What a cell holds: a character, or a mask of the sub-cell pixels
+    // drawn by SubcellCanvas, sent as a block or Braille glyph
+    enum Glyphs { TEXT, HALF_BLOCKS, BRAILLE };
+
+    // What present() does when the writer has not picked up the previous frame yet
+    enum DropPolicy {
+        DROP_OLDEST,    // replace the waiting frame with the new one
+        DROP_NEWEST,    // discard the new frame, keep the waiting one
+        BLOCK           // wait for the writer, never drop
+    };
+
+    StreamHandler(std::ostream& stream, int width, int height): width(width), height(height), stream(stream) {
+        frames[0] = CharFrame(width, height);
         clear(' ');
     }
 
@@ -25,127 +1074,252 @@ public:
         this->Wh_koef = CharWidthOverHeight_koef;
         this->width = (int) std::roundf((float)height / Wh_koef);
 
-        buffer = std::vector(height, std::string(width, ' '));
+        frames[0] = CharFrame(width, height);
 
         clear(' ');
     }
 
-    ~StreamHandler() {}
+    ~StreamHandler() {
+        stop_writer();
+    }
 
     std::pair<int,int> size() const { return {width, height}; }
     float koef() const { return Wh_koef; }
+
+#ifndef _WIN32
+    // Write frames straight to a descriptor instead of the stream,
+    // one syscall per frame. -1 goes back to the stream.
+    void set_output_fd(int fd) { this->fd = fd; }
+#endif
     
-    void clear(char color = ' ') {
-        for (auto& str: buffer) {
-            for (auto& c: str) {
-                c = color;
+    // Switches between immediate drawing and recording draw calls for a
+    // tiled, multithreaded submit(). Leaving deferred mode submits.
+    void set_deferred(bool enabled, int threads = std::thread::hardware_concurrency()) {
+        if (deferred && !enabled) submit();
+        deferred = enabled;
+        if (!enabled) return;
+
+        threads = (std::max)(threads, 1);
+        if (!pool || pool->size() != threads) pool.reset(new WorkerPool(threads));
+    }
+
+    // Rasterizes the recorded commands. Each worker owns one tile at a time
+    // and replays the commands touching it in order, clipped to the tile.
+    void submit() {
+        if (commands.empty()) return;
+
+        int tiles_x = (width + tile_width - 1) / tile_width;
+        int tiles_y = (height + tile_height - 1) / tile_height;
+        int tiles = tiles_x * tiles_y;
+        bin_end.assign(tiles + 1, 0);
+        boxes.resize(commands.size());
+        for (int i=0; i<(int)commands.size(); i++) {
+            Rect& box = boxes[i];
+            box = bounds(commands[i]);
+            box.x0 = (std::max)(box.x0, 0); box.x1 = (std::min)(box.x1, width - 1);
+            box.y0 = (std::max)(box.y0, 0); box.y1 = (std::min)(box.y1, height - 1);
+            if (box.x0 > box.x1 || box.y0 > box.y1) continue;
+
+            buffer->touch(box.x0, box.y0, box.x1, box.y1);
+            for (int ty=box.y0/tile_height; ty<=box.y1/tile_height; ty++) {
+                for (int tx=box.x0/tile_width; tx<=box.x1/tile_width; tx++) {
+                    bin_end[ty*tiles_x + tx + 1]++;
+                }
             }
         }
+        // start of every bin, advanced to its end while filling
+        for (int t=0; t<tiles; t++) bin_end[t + 1] += bin_end[t];
+        binned.resize(bin_end[tiles]);
+        for (int i=0; i<(int)commands.size(); i++) {
+            const Rect& box = boxes[i];
+            if (box.x0 > box.x1 || box.y0 > box.y1) continue;
+            for (int ty=box.y0/tile_height; ty<=box.y1/tile_height; ty++) {
+                for (int tx=box.x0/tile_width; tx<=box.x1/tile_width; tx++) {
+                    binned[bin_end[ty*tiles_x + tx]++] = i;
+                }
+            }
+        }
+
+        pool->run(tiles_x * tiles_y, [this, tiles_x](int tile) {
+            int tx = tile % tiles_x;
+            int ty = tile / tiles_x;
+            Rect clip = {
+                tx*tile_width, ty*tile_height,
+                (std::min)((tx + 1)*tile_width, width) - 1,
+                (std::min)((ty + 1)*tile_height, height) - 1
+            };
+            for (int k=tile ? bin_end[tile - 1] : 0; k<bin_end[tile]; k++) execute(commands[binned[k]], clip);
+        });
+        commands.clear();
     }
 
-    void flush() {
-        for (auto& str: buffer) {
-            stream.get() << str << std::endl;
+    // Resets only the cells drawn since the last clear. Masks are always
+    // cleared to empty.
+    void clear(char color = ' ') {
+        commands.clear();
+        buffer->clear(glyph_table ? 0 : color);
+    }
+
+    // Switches the meaning of the cells; call it before start_writer().
+    void set_glyphs(Glyphs glyphs) {
+        glyph_table = make_glyph_table(glyphs);
+        clear();
+    }
+
+    // Changes the canvas size, e.g. after SIGWINCH. The frames keep their
+    // storage unless they grow, the canvas comes back cleared and the next
+    // DIFF output redraws the screen. A running writer is paused meanwhile,
+    // so the thread outlives the resize.
+    void resize(int width, int height) {
+        bool running = writer.joinable();
+        if (running) pause_writer();
+        commands.clear();
+
+        this->width = width;
+        this->height = height;
+        for (auto& frame: frames) {
+            if (!frame.empty()) frame.resize(width, height);
+        }
+        // here rather than at the redraw, which may fall on the writer thread
+        if (!previous.empty()) previous.resize(width, height);
+        redraw = true;
+        if (running) {
+            // the writer thread must not grow it while encoding
+            out.reserve(max_encoded_size());
+            resume_writer();
         }
     }
+
+    // Marks the whole canvas as drawn, for writes the tracking can't see.
+    void invalidate() {
+        buffer->touch(0, 0, width - 1, height - 1);
+    }
+
+    void flush() {
+        submit();
+        send(*buffer, FULL);
+    }
     void flush_ansi() {
-        stream.get() << "\x1b[3" << std::flush;
-        for (auto& str: buffer) {
-            stream.get() << str << std::endl;
-        }
+        submit();
+        send(*buffer, ANSI);
     }
 
-    char& at(int x, int y) {
-        // std::cout << "Write(" << x << "," << y << ")" << std::endl;
-        return buffer[y][x];
+    // Sends only the runs that changed since the previous flush_diff(),
+    // positioning the cursor with CUP sequences.
+    void flush_diff() {
+        submit();
+        send(*buffer, DIFF);
     }
-    const char& at(int x, int y) const {
-        return buffer[y][x];
+
+    // Prints bytes/frame and dropped frames under the canvas on DIFF output.
+    void show_stats(bool enabled) { stats_line = enabled; }
+
+    // Starts a writer thread that outputs presented frames in the given
+    // mode while the next one is drawn. Don't call flush*() while it runs.
+    void start_writer(FlushMode mode = DIFF, DropPolicy policy = DROP_OLDEST) {
+        if (writer.joinable()) return;
+        for (auto& frame: frames) {
+            if (frame.empty()) frame = CharFrame(width, height);
+            if (colored) frame.add_colors();
+        }
+
+        // the thread itself then allocates nothing
+        previous.resize(width, height);
+        if (colored) previous.add_colors();
+        out.reserve(max_encoded_size());
+
+        unsigned back = buffer - frames;
+        drop_policy = policy;
+        slot = (back + 1) % 3;
+        writer = std::thread(&StreamHandler::write_loop, this, (int)mode, (back + 2) % 3);
     }
 
-    void put(float xf, float yf, char color) {
-        int x = std::clamp(std::round(xf), 0.0f, (float)width-1);
-        int y = std::clamp(std::round(yf), 0.0f, (float)height-1);
-        at(x,y) = color;
-    }
-
-    void draw_line(float x0, float y0, float x1, float y1, char color, bool flipped=false) {
-        if (!flipped) {
-            x0 = std::clamp(x0, 0.0f, (float)width-1);
-            x1 = std::clamp(x1, 0.0f, (float)width-1);
-            y0 = std::clamp(y0, 0.0f, (float)height-1);
-            y1 = std::clamp(y1, 0.0f, (float)height-1);
-        }
-
-        if (x0 > x1) {
-            float temp;
-
-            temp = x0; x0 = x1; x1 = temp;
-            temp = y0; y0 = y1; y1 = temp;
-        }
-
-        int xfrom = x0;
-        int xto = x1;
-        int yfrom = y0;
-        int yto = y1;
-        
-        // std::cout << "Line from " << x0 << " " << y0 << " to " << x1 << " " << y1 << std::endl;
-        
-        int diry = y1-y0;
-        if (diry > 0) diry = 1;
-        else if (diry < 0) diry = -1;
-        
-        int dirx = 1;
-        // int dirx = x1-x0;
-        // if (dirx > 0) dirx = 1;
-        // else if (dirx < 0) dirx = -1;
-        
-        if (x1 == x0) {
-            // std::cout << "x0==x1" << std::endl;
-            for (int y=yfrom; y != yto+diry; y += diry) {
-                this->put(xfrom, y ,color);
-            }
+    // Lets the writer finish the waiting frame, then joins it.
+    void stop_writer() {
+        if (!writer.joinable()) return;
+        slot.fetch_or(SLOT_STOP);
+        slot.notify_all();
+        writer.join();
+        slot = 0;
+    }
+
+    // Hands the finished frame to the writer thread and continues on another
+    // one. The new canvas holds an old frame, so clear() before drawing.
+    void present() {
+        submit();
+        presented++;
+        if (!writer.joinable()) {
+            send(*buffer, DIFF);
+            written++;
             return;
         }
-        if (y1 == y0) {
-            // std::cout << "y0==y1" << std::endl;
-            for (int x=xfrom; x != xto+dirx; x += dirx) {
-                this->put(x, yfrom, color);
+
+        unsigned back = buffer - frames;
+        unsigned current = slot.load(std::memory_order_acquire);
+        if (current & SLOT_FRESH) {
+            if (drop_policy == DROP_NEWEST) {
+                dropped++;
+                return;
+            }
+            if (drop_policy == BLOCK) {
+                while ((current = slot.load(std::memory_order_acquire)) & SLOT_FRESH) {
+                    slot.wait(current);
+                }
             }
-            return;
-        }
-        
-        float dxf = x1 - x0;
-        float dyf = y1 - y0;
-        
-        
-        float steep = dyf/dxf;
-        // std::cout << "steep = " << steep << std::endl;
-        float error = 0;
-        float de = std::abs(steep);
-        
-        if (!flipped && de > 1) {
-            // std::cout << "flip" << std::endl;
-            draw_line(y0, x0, y1, x1, color, true);
-            return;
         }
 
-        
-        int y = y0;
-        float yf = y0;
+        unsigned previous_slot = slot.exchange(back | SLOT_FRESH, std::memory_order_acq_rel);
+        slot.notify_all();
+        if (previous_slot & SLOT_FRESH) dropped++;
+        buffer = &frames[previous_slot & SLOT_INDEX];
+    }
+
+    long frames_presented() const { return presented; }
+    long frames_written() const { return written; }
+    long frames_dropped() const { return dropped; }
+
+    // bytes and write calls of the last flush
+    size_t last_flush_bytes() const { return flushed_bytes; }
+    int last_flush_writes() const { return flushed_writes; }
+
+    // the frame being drawn
+    const CharFrame& frame() const { return *buffer; }
+
+    char& at(int x, int y) {
+        // std::cout << "Write(" << x << "," << y << ")" << std::endl;
+        buffer->touch(x, y, x, y);
+        return buffer->row(y)[x];
+    }
+    const char& at(int x, int y) const {
+        return buffer->row(y)[x];
+    }
 
-        for (int x=xfrom; x!= xto+dirx; x += dirx) {
-            if (flipped) this->put(y,x,color);
-            else this->put(x,y,color);
-            error = error + de;
-            while (error > 1) {
-                yf += diry;
-                error -= 1;
+    // Foreground and background for the following draw calls. The first
+    // call adds color planes to the canvas; make it before start_writer().
+    void set_color(Color fg, Color bg = Color()) {
+        if (!colored) {
+            colored = true;
+            for (auto& frame: frames) {
+                if (!frame.empty()) frame.add_colors();
             }
-            y = std::roundf(yf);
         }
+        pen = Color::pack(fg, bg);
+    }
+
+    std::pair<Color, Color> colors_at(int x, int y) const {
+        if (!colored) return {};
+        uint64_t cell = buffer->color_row(y)[x];
+        return {Color{(uint32_t)cell}, Color{(uint32_t)(cell >> 32)}};
     }
 
+    void put(float xf, float yf, char color) {
+        issue(Command::POINT, {xf, yf}, color);
+    }
+
+    // Integer Bresenham, clipped (not clamped) to the canvas.
+    void draw_line(float x0, float y0, float x1, float y1, char color) {
+        issue(Command::LINE, {x0, y0, x1, y1}, color);
+    }
 
     void draw_triangle(
         float x0, float y0,
@@ -153,9 +1327,18 @@ public:
         float x2, float y2,
         char color
     ) {
-        draw_line(x0, y0, x1, y1, color);
-        draw_line(x1, y1, x2, y2, color);
-        draw_line(x2, y2, x0, y0, color);
+        issue(Command::TRIANGLE, {x0, y0, x1, y1, x2, y2}, color);
+    }
+
+    // Solid triangle with a top-left fill rule, so triangles sharing an
+    // edge never cover the same cell twice.
+    void draw_filled_triangle(
+        float x0, float y0,
+        float x1, float y1,
+        float x2, float y2,
+        char color
+    ) {
+        issue(Command::FILLED_TRIANGLE, {x0, y0, x1, y1, x2, y2}, color);
     }
 
     void draw_circle(
@@ -163,41 +1346,209 @@ public:
         float R,
         char color
     ) {
-        // std::cout << "Circle(" << x0 << "," << y0 << ",R=" << R << ")" << std::endl;
+        draw_ellipse(x0, y0, R, R, color);
+    }
 
-        float x = 0;
-        float y = R;
+    // Filled shapes are written as one memset per row.
+    void draw_filled_circle(
+        float x0, float y0,
+        float R,
+        char color
+    ) {
+        draw_filled_ellipse(x0, y0, R, R, color);
+    }
 
-        float delta = 1 - 2*R;
-        float error = 0;
+    void draw_ellipse(
+        float x0, float y0,
+        float rx, float ry,
+        char color
+    ) {
+        issue(Command::ELLIPSE, {x0, y0, rx, ry}, color);
+    }
 
-        while (y >= x) {
-            this->put(x0 + x, y0 + y, color);
-            this->put(x0 + x, y0 - y, color);
-            this->put(x0 - x, y0 + y, color);
-            this->put(x0 - x, y0 - y, color);
-            this->put(x0 + y, y0 + x, color);
-            this->put(x0 + y, y0 - x, color);
-            this->put(x0 - y, y0 + x, color);
-            this->put(x0 - y, y0 - x, color);
+    void draw_filled_ellipse(
+        float x0, float y0,
+        float rx, float ry,
+        char color
+    ) {
+        issue(Command::FILLED_ELLIPSE, {x0, y0, rx, ry}, color);
+    }
+};
 
-            error = 2 * (delta + y) - 1;
+// Drawing surface with sx*sy pixels per cell of a StreamHandler: 1x2 in
+// HALF_BLOCKS and 2x4 in BRAILLE mode. Every cell holds one byte, the mask
+// of its lit pixels, and goes out as one glyph. Coordinates are in pixels,
+// pixel (x, y) lies in cell (x/sx, y/sy). Draws immediately, in the pen
+// colors of the handler; a cell takes the colors of the last draw into it.
+class SubcellCanvas {
+    StreamHandler& sh;
+    int sx, sy;
+    int width, height;
+    uint8_t bits[4][2];     // mask bit of pixel (x%sx, y%sy)
 
-            if ((delta < 0) && (error <= 0)) {
-                x += 1;
-                delta += 2*x + 1;
-                continue;
+    // pixels x0..x1 of pixel row y
+    void span(long long y, long long x0, long long x1) {
+        if (y < 0 || y >= height) return;
+        x0 = (std::max)(x0, 0LL);
+        x1 = (std::min)(x1, (long long)width - 1);
+        if (x0 > x1) return;
+
+        int cy = y / sy, r = y % sy;
+        int cx0 = x0 / sx, cx1 = x1 / sx;
+        CharFrame& frame = *sh.buffer;
+        frame.touch(cx0, cy, cx1, cy);
+        char* cells = frame.row(cy);
+        uint8_t full = bits[r][0] | bits[r][sx - 1];
+        for (int cx=cx0; cx<=cx1; cx++) {
+            int c0 = cx == cx0 ? x0 % sx : 0;
+            int c1 = cx == cx1 ? x1 % sx : sx - 1;
+            cells[cx] |= c0 == 0 && c1 == sx - 1 ? full : bits[r][c0] | bits[r][c1];
+        }
+        if (sh.colored) std::fill_n(frame.color_row(cy) + cx0, cx1 - cx0 + 1, sh.pen);
+    }
+
+    // the midpoint ellipse of StreamHandler::raster_ellipse, in pixels
+    void ellipse(float x0, float y0, float rx, float ry, bool filled) {
+        const float radius_guard = StreamHandler::guard_band / 2;
+        if (!(std::abs(x0) < StreamHandler::guard_band) || !(std::abs(y0) < StreamHandler::guard_band)) return;
+        if (!(rx >= 0 && rx < radius_guard) || !(ry >= 0 && ry < radius_guard)) return;
+        long long cx = std::lround(x0);
+        long long cy = std::lround(y0);
+        long long a = std::lround(rx);
+        long long b = std::lround(ry);
+
+        long long from = (std::max)(0LL, cy - b);
+        long long to = (std::min)((long long)height - 1, cy + b);
+        if (from > to) return;
+
+        long long d = std::abs(from - cy);
+        long long h = StreamHandler::ellipse_span(a, b, d);
+        long long next = StreamHandler::ellipse_span(a, b, d + 1);
+        for (long long y=from; y<=to; y++) {
+            if (filled) span(y, cx - h, cx + h);
+            else {
+                long long inner = (std::min)(next + 1, h);
+                span(y, cx + inner, cx + h);
+                span(y, cx - h, cx - inner);
             }
 
-            if ((delta > 0) && (error > 0)) {
-                y -= 1;
-                delta -= 2 * y + 1;
-                continue;
+            if (y < cy) {
+                next = h;
+                h = StreamHandler::ellipse_span(a, b, --d);
+            }
+            else {
+                h = next;
+                next = StreamHandler::ellipse_span(a, b, ++d + 1);
             }
+        }
+    }
+public:
+    SubcellCanvas(StreamHandler& sh, StreamHandler::Glyphs glyphs = StreamHandler::BRAILLE): sh(sh) {
+        sh.set_glyphs(glyphs);
+        if (glyphs == StreamHandler::BRAILLE) {
+            sx = 2;
+            sy = 4;
+            const uint8_t dots[4][2] = {{0x01, 0x08}, {0x02, 0x10}, {0x04, 0x20}, {0x40, 0x80}};
+            std::memcpy(bits, dots, sizeof(bits));
+        }
+        else {
+            sx = 1;
+            sy = 2;
+            const uint8_t halves[4][2] = {{0x01, 0x01}, {0x02, 0x02}};
+            std::memcpy(bits, halves, sizeof(bits));
+        }
+        width = sh.width * sx;
+        height = sh.height * sy;
+    }
 
-            x += 1; y -= 1;
-            delta += 2 * (x - y);
+    std::pair<int,int> size() const { return {width, height}; }
+
+    void clear() { sh.clear(); }
+
+    void put(float x, float y) {
+        if (!(std::abs(x) < StreamHandler::guard_band) || !(std::abs(y) < StreamHandler::guard_band)) return;
+        long long px = std::lround(x);
+        span(std::lround(y), px, px);
+    }
+
+    // Bresenham over the part of the segment inside the canvas.
+    void draw_line(float x0, float y0, float x1, float y1) {
+        if (!std::isfinite(x0) || !std::isfinite(y0) || !std::isfinite(x1) || !std::isfinite(y1)) return;
+        if (!StreamHandler::clip_segment(x0, y0, x1, y1, -0.5f, -0.5f, width - 0.5f, height - 0.5f)) return;
+
+        int px = std::clamp((int)std::lround(x0), 0, width - 1);
+        int py = std::clamp((int)std::lround(y0), 0, height - 1);
+        int ex = std::clamp((int)std::lround(x1), 0, width - 1);
+        int ey = std::clamp((int)std::lround(y1), 0, height - 1);
+
+        int dx = std::abs(ex - px), dy = -std::abs(ey - py);
+        int step_x = px < ex ? 1 : -1, step_y = py < ey ? 1 : -1;
+        int error = dx + dy;
+        while (true) {
+            span(py, px, px);
+            if (px == ex && py == ey) break;
+            int twice = 2*error;
+            if (twice >= dy) {
+                error += dy;
+                px += step_x;
+            }
+            if (twice <= dx) {
+                error += dx;
+                py += step_y;
+            }
         }
-        
     }
-};
\ No newline at end of file
+
+    void draw_triangle(float x0, float y0, float x1, float y1, float x2, float y2) {
+        draw_line(x0, y0, x1, y1);
+        draw_line(x1, y1, x2, y2);
+        draw_line(x2, y2, x0, y0);
+    }
+
+    // Same edge functions and fill rule as StreamHandler, solved for the
+    // covered range of each pixel row.
+    void draw_filled_triangle(float x0, float y0, float x1, float y1, float x2, float y2) {
+        const int subpixel_bits = StreamHandler::subpixel_bits;
+        float coords[6] = {x0, y0, x1, y1, x2, y2};
+        long long v[6];
+        for (int i=0; i<6; i++) {
+            if (!(std::abs(coords[i]) < StreamHandler::guard_band)) return;
+            v[i] = std::lround(coords[i] * (1 << subpixel_bits));
+        }
+
+        long long area = (v[2] - v[0]) * (v[5] - v[1]) - (v[3] - v[1]) * (v[4] - v[0]);
+        if (area == 0) return;
+        if (area < 0) {
+            std::swap(v[2], v[4]);
+            std::swap(v[3], v[5]);
+        }
+
+        const int one = 1 << subpixel_bits;
+        long long minx = (std::max)(((std::min)({v[0], v[2], v[4]}) + one - 1) >> subpixel_bits, 0LL);
+        long long maxx = (std::min)((std::max)({v[0], v[2], v[4]}) >> subpixel_bits, (long long)width - 1);
+        long long miny = (std::max)(((std::min)({v[1], v[3], v[5]}) + one - 1) >> subpixel_bits, 0LL);
+        long long maxy = (std::min)((std::max)({v[1], v[3], v[5]}) >> subpixel_bits, (long long)height - 1);
+
+        StreamHandler::Edge edges[3] = {
+            StreamHandler::Edge(v[0], v[1], v[2], v[3]),
+            StreamHandler::Edge(v[2], v[3], v[4], v[5]),
+            StreamHandler::Edge(v[4], v[5], v[0], v[1]),
+        };
+        for (long long y=miny; y<=maxy; y++) {
+            long long lo = minx, hi = maxx;
+            for (const auto& edge: edges) {
+                // edge.at(x, y) + bias >= 0, linear in x
+                long long base = edge.at(0, y) + edge.bias;
+                if (edge.step_x > 0) lo = (std::max)(lo, -StreamHandler::floor_div(base, edge.step_x));
+                else if (edge.step_x < 0) hi = (std::min)(hi, StreamHandler::floor_div(base, -edge.step_x));
+                else if (base < 0) hi = lo - 1;
+            }
+            span(y, lo, hi);
+        }
+    }
+
+    void draw_circle(float x0, float y0, float R) { draw_ellipse(x0, y0, R, R); }
+    void draw_filled_circle(float x0, float y0, float R) { draw_filled_ellipse(x0, y0, R, R); }
+    void draw_ellipse(float x0, float y0, float rx, float ry) { ellipse(x0, y0, rx, ry, false); }
+    void draw_filled_ellipse(float x0, float y0, float rx, float ry) { ellipse(x0, y0, rx, ry, true); }
+};
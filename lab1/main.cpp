@@ -9,6 +9,15 @@
 #include <algorithm>
 
 #include <memory>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cstddef>
+
+#include "../lab0/frame_scheduler.hpp"
+#include "../lab0/object_store.hpp"
+#include "../lab0/circle_tables.hpp"
 
 namespace GL {
     #include <GL/glew.h>
@@ -55,11 +64,15 @@ struct Color {
 
 double FPS = 60.0f;
 double delaytime = 1000000.0f/FPS;
+// шаг симуляции равен state->dt, кадры - по абсолютным дедлайнам
+FrameScheduler scheduler(FPS);
 
 void setFPS(double nFPS) {
     if (nFPS <= 0) return;
     FPS = nFPS;
     delaytime = 1000000/nFPS;
+    scheduler.set_fps(nFPS);
+    scheduler.set_step(1/nFPS);
 }
 
 
@@ -84,64 +97,34 @@ void draw_line(Point start, Point end, Color color, int width) {
 }
 
 
-void draw_circle(Point center, double radius, Color color, double width, int shapeness) {
+void draw_ellipse(Point center, Point radii, Color color, double width, int shapeness) {
+    auto& circle = unit_circle(shapeness);
     GL::glColor4f(color.r, color.g, color.b, color.a);
     GL::glLineWidth(width);
-    Point p1 = {center.x + radius, center.y};
-    double koef = (2*M_PI)/shapeness;
     GL::glBegin(GL_LINES);
-    for (int i=0; i<shapeness+1; i++) {
-        GL::glVertex2d(p1.x, p1.y);
-        p1.x = center.x + cos((double)i*koef)*radius;
-        p1.y = center.y + sin((double)i*koef)*radius;
-        GL::glVertex2d(p1.x, p1.y);
+    for (size_t i=1; i<circle.size(); i++) {
+        GL::glVertex2d(center.x + circle[i-1].x*radii.x, center.y + circle[i-1].y*radii.y);
+        GL::glVertex2d(center.x + circle[i].x*radii.x, center.y + circle[i].y*radii.y);
     }
     GL::glEnd();
 }
 
-void draw_filled_circle(Point center, double radius, Color color, int shapeness) {
-    // std::cout << "(" << center.x << " " << center.y << ")" << " " << radius << std::endl;
+void draw_filled_ellipse(Point center, Point radii, Color color, int shapeness) {
+    auto& circle = unit_circle(shapeness);
     GL::glColor4f(color.r, color.g, color.b, color.a);
-    Point p1 = {center.x + radius, center.y};
-    double koef = (2*M_PI)/shapeness;
     GL::glBegin(GL_TRIANGLE_FAN);
-    for (int i=0; i<shapeness+1; i++) {
-        GL::glVertex2d(p1.x, p1.y);
-        p1.x = center.x + cos((double)i*koef)*radius;
-        p1.y = center.y + sin((double)i*koef)*radius;
-        GL::glVertex2d(p1.x, p1.y);
+    for (auto& p: circle) {
+        GL::glVertex2d(center.x + p.x*radii.x, center.y + p.y*radii.y);
     }
     GL::glEnd();
 }
 
-void draw_ellipse(Point center, Point radii, Color color, double width, int shapeness) {
-    GL::glColor4f(color.r, color.g, color.b, color.a);
-    GL::glLineWidth(width);
-    Point p1 = {center.x + radii.x, center.y};
-    double koef = (2*M_PI)/shapeness;
-    GL::glBegin(GL_LINES);
-    for (int i=0; i<shapeness+1; i++) {
-        GL::glVertex2d(p1.x, p1.y);
-        p1.x = center.x + cos((double)i*koef)*radii.x;
-        p1.y = center.y + sin((double)i*koef)*radii.y;
-        GL::glVertex2d(p1.x, p1.y);
-    }
-    GL::glEnd();
+void draw_circle(Point center, double radius, Color color, double width, int shapeness) {
+    draw_ellipse(center, Point(radius, radius), color, width, shapeness);
 }
 
-void draw_filled_ellipse(Point center, Point radii, Color color, int shapeness) {
-    // std::cout << "(" << center.x << " " << center.y << ")" << " " << radius << std::endl;
-    GL::glColor4f(color.r, color.g, color.b, color.a);
-    Point p1 = {center.x + radii.x, center.y};
-    double koef = (2*M_PI)/shapeness;
-    GL::glBegin(GL_TRIANGLE_FAN);
-    for (int i=0; i<shapeness+1; i++) {
-        GL::glVertex2d(p1.x, p1.y);
-        p1.x = center.x + cos((double)i*koef)*radii.x;
-        p1.y = center.y + sin((double)i*koef)*radii.y;
-        GL::glVertex2d(p1.x, p1.y);
-    }
-    GL::glEnd();
+void draw_filled_circle(Point center, double radius, Color color, int shapeness) {
+    draw_filled_ellipse(center, Point(radius, radius), color, shapeness);
 }
 
 void draw_rect(Point point,  double width, double height, Color color, double linewidth) {
@@ -238,38 +221,31 @@ class ComplexObject: public UpdatableObject, public DrawableObject {};
 
 class Stage: public ComplexObject {
 public:
-    std::vector< std::shared_ptr<UpdatableObject> > updaties;
-    std::vector< std::shared_ptr<DrawableObject> > drawies;
+    // один handle на объект: он обновляется и рисуется, пока update не вернёт false
+    using Store = ObjectStore< std::shared_ptr<ComplexObject> >;
+    using Handle = Store::Handle;
+    Store objects;
 
-    void add_updatie(std::shared_ptr<UpdatableObject> obj) {
-        updaties.push_back(obj);
+    Handle add(std::shared_ptr<ComplexObject> obj) {
+        return objects.add(obj);
     }
 
-    void add_drawie(std::shared_ptr<DrawableObject> obj) {
-        drawies.push_back(obj);
+    bool remove(Handle handle) {
+        return objects.remove(handle);
     }
 
     bool update(std::shared_ptr<State> state) override {
-        std::vector<void*> to_remove;
-        for (auto& obj: updaties) {
-            if (obj->update(state) == false) {
-                to_remove.push_back(obj.get());
-            }
-        }
-        for (void* ptr: to_remove) {
-            auto it = std::find_if(updaties.begin(), updaties.end(),
-                [ptr](const std::shared_ptr<UpdatableObject>& sp) {
-                    return sp.get() == ptr;
-                });
-            if (it != updaties.end()) {
-                updaties.erase(it);
-            }
+        // на место удалённого встаёт последний объект, он ещё не обновлён;
+        // объекты сцены добавлены раньше метеоров, их порядок не меняется
+        for (size_t i=0; i<objects.size(); ) {
+            if (objects[i]->update(state)) i++;
+            else objects.remove_at(i);
         }
         return true;
     }
 
     void draw(std::shared_ptr<DrawingContext> context) override {
-        for (auto& obj: drawies) {
+        for (auto& obj: objects) {
             obj->draw(context);
         }
     }
@@ -333,34 +309,327 @@ public:
     void draw(std::shared_ptr<DrawingContext> context) override {
         // std::cout << "Circle " << std::endl;
 
-        if (filled) draw_filled_ellipse(context->transform(center), Point(context->transform_x(radius), context->transform_y(radius)), color, 100);
-        else draw_ellipse(context->transform(center), Point(context->transform_x(radius), context->transform_y(radius)), color, linewidth, 100);
+        Point radii(context->transform_x(radius), context->transform_y(radius));
+        int segments = circle_segments(std::max(radii.x, radii.y));
+        if (filled) draw_filled_ellipse(context->transform(center), radii, color, segments);
+        else draw_ellipse(context->transform(center), radii, color, linewidth, segments);
     }
 };
 
-class Meteor: public ComplexObject {
+// xoshiro128+ в lanes независимых потоках: шаг сразу по всем потокам
+// векторизуется, так что случайные числа для всего пула почти бесплатны.
+class LaneRandom {
 public:
-    std::shared_ptr<Circle> circle;
-    Point direction;
-    double speed;
-    bool finished = false;
-    Meteor(std::shared_ptr<Circle> circle, Point direction, double speed): circle(circle), direction(direction), speed(speed) {}
+    static constexpr int lanes = 8;
+private:
+    uint32_t s0[lanes], s1[lanes], s2[lanes], s3[lanes];
+    float buffer[lanes];
+    int used = lanes;
+public:
+    LaneRandom(uint64_t seed) {
+        // splitmix64 разводит потоки по разным состояниям
+        auto next_seed = [&seed]() {
+            uint64_t z = (seed += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
+        };
+        for (int l=0; l<lanes; l++) {
+            uint64_t a = next_seed(), b = next_seed();
+            s0[l] = a; s1[l] = a >> 32; s2[l] = b; s3[l] = (b >> 32) | 1;
+        }
+    }
 
-    bool update(std::shared_ptr<State> state) override {
-        if (finished) return false;
+    // lanes чисел из [0, 1)
+    void next(float* out) {
+        for (int l=0; l<lanes; l++) {
+            uint32_t result = s0[l] + s3[l];
+            uint32_t t = s1[l] << 9;
+            s2[l] ^= s0[l];
+            s3[l] ^= s1[l];
+            s1[l] ^= s2[l];
+            s0[l] ^= s3[l];
+            s2[l] ^= t;
+            s3[l] = (s3[l] << 11) | (s3[l] >> 21);
+            out[l] = (result >> 8) * (1.0f / 16777216);
+        }
+    }
+
+    float uniform() {
+        if (used == lanes) {
+            next(buffer);
+            used = 0;
+        }
+        return buffer[used++];
+    }
+};
 
-        circle->center = circle->center +  direction * state->dt * speed;
-        circle->radius *= 1 + 0.1*(drand()*2-1);
-        if (circle->center.y + circle->radius < 0) {
-            finished = true; 
+// Метеор для glDrawArraysInstanced: центр и полуоси в пикселях и цвет.
+struct MeteorInstance {
+    float x, y, rx, ry;
+    uint8_t r, g, b, a;
+};
+static_assert(sizeof(MeteorInstance) == 20);
+
+// Все метеоры одним glDrawArraysInstanced: единичный квадрат загружается
+// один раз, а круг на нём вырезает фрагментный шейдер. За кадр в буфер
+// уходят только экземпляры, по 20 байт на метеор вместо ~30 вершин.
+class InstancedRenderer {
+    enum Attribute { POSITION, CENTER, RADII, COLOR };
+
+    GL::GLuint program = 0;
+    GL::GLuint quad_buffer = 0;
+    GL::GLuint instance_buffer = 0;
+
+    static GL::GLuint compile(GL::GLenum type, const char* source) {
+        GL::GLuint shader = GL::glCreateShader(type);
+        GL::glShaderSource(shader, 1, &source, nullptr);
+        GL::glCompileShader(shader);
+        GL::GLint ok = 0;
+        GL::glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+        if (!ok) {
+            char log[1024] = "";
+            GL::glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            std::cerr << "shader: " << log << std::endl;
+        }
+        return shader;
+    }
+
+public:
+    // false, если GL старше 3.3 или программа не собралась
+    bool init() {
+        if (!GL::GLEW_VERSION_3_3) return false;
+
+        // Квадрат раздут на пиксель наружу, чтобы сглаженному краю было
+        // где лечь; fwidth переводит расстояние до окружности в пиксели.
+        GL::GLuint vertex = compile(GL_VERTEX_SHADER, R"(
+            #version 120
+            attribute vec2 position;
+            attribute vec2 center;
+            attribute vec2 radii;
+            attribute vec4 color;
+            varying vec4 v_color;
+            varying vec2 local;
+            void main() {
+                local = position * (1.0 + 1.0/radii);
+                gl_Position = gl_ModelViewProjectionMatrix * vec4(center + radii*local, 0.0, 1.0);
+                v_color = color;
+            }
+        )");
+        GL::GLuint fragment = compile(GL_FRAGMENT_SHADER, R"(
+            #version 120
+            varying vec4 v_color;
+            varying vec2 local;
+            void main() {
+                float d = length(local) - 1.0;
+                float coverage = clamp(0.5 - d/fwidth(d), 0.0, 1.0);
+                if (coverage <= 0.0) discard;
+                gl_FragColor = vec4(v_color.rgb, coverage);
+            }
+        )");
+        program = GL::glCreateProgram();
+        GL::glAttachShader(program, vertex);
+        GL::glAttachShader(program, fragment);
+        GL::glBindAttribLocation(program, POSITION, "position");
+        GL::glBindAttribLocation(program, CENTER, "center");
+        GL::glBindAttribLocation(program, RADII, "radii");
+        GL::glBindAttribLocation(program, COLOR, "color");
+        GL::glLinkProgram(program);
+        GL::glDeleteShader(vertex);
+        GL::glDeleteShader(fragment);
+
+        GL::GLint ok = 0;
+        GL::glGetProgramiv(program, GL_LINK_STATUS, &ok);
+        if (!ok) {
+            GL::glDeleteProgram(program);
+            program = 0;
             return false;
         }
 
+        const float quad[] = {-1, -1, 1, -1, 1, 1, -1, 1};
+        GL::glGenBuffers(1, &quad_buffer);
+        GL::glBindBuffer(GL_ARRAY_BUFFER, quad_buffer);
+        GL::glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+        GL::glGenBuffers(1, &instance_buffer);
+        GL::glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return true;
+    }
+
+    void draw(const std::vector<MeteorInstance>& instances) {
+        if (instances.empty()) return;
+
+        GL::glUseProgram(program);
+        GL::glBindBuffer(GL_ARRAY_BUFFER, quad_buffer);
+        GL::glEnableVertexAttribArray(POSITION);
+        GL::glVertexAttribPointer(POSITION, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+        // старое содержимое не нужно: драйвер отдаёт новую память, не
+        // дожидаясь кадра, который ещё читает прежнюю
+        GL::glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+        GL::glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(MeteorInstance), instances.data(), GL_STREAM_DRAW);
+        GL::glVertexAttribPointer(CENTER, 2, GL_FLOAT, GL_FALSE, sizeof(MeteorInstance), (void*)offsetof(MeteorInstance, x));
+        GL::glVertexAttribPointer(RADII, 2, GL_FLOAT, GL_FALSE, sizeof(MeteorInstance), (void*)offsetof(MeteorInstance, rx));
+        GL::glVertexAttribPointer(COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(MeteorInstance), (void*)offsetof(MeteorInstance, r));
+        for (int attribute = CENTER; attribute <= COLOR; attribute++) {
+            GL::glEnableVertexAttribArray(attribute);
+            GL::glVertexAttribDivisor(attribute, 1);
+        }
+
+        GL::glEnable(GL_BLEND);
+        GL::glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        GL::glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, instances.size());
+        GL::glDisable(GL_BLEND);
+
+        for (int attribute = POSITION; attribute <= COLOR; attribute++) {
+            GL::glVertexAttribDivisor(attribute, 0);
+            GL::glDisableVertexAttribArray(attribute);
+        }
+        GL::glBindBuffer(GL_ARRAY_BUFFER, 0);
+        GL::glUseProgram(0);
+    }
+};
+
+InstancedRenderer instancedRenderer;
+bool instanced = false;
+
+// Все метеоры в одном объекте, каждое поле - отдельный массив float.
+// Шаг идёт одним проходом по массивам без виртуальных вызовов и rand(),
+// сгоревшие заменяются последним метеором.
+class MeteorPool: public ComplexObject {
+public:
+    std::vector<float> x, y, dx, dy, speed, radius;
+    std::vector<float> r, g, b;
+    std::vector<float> noise;   // случайные числа на текущий шаг
+    LaneRandom random;
+
+    // Все метеоры кадра для одного glDrawElements: вершины вееров и
+    // индексы их треугольников. Массивы живут между кадрами.
+    struct Vertex {
+        float x, y;
+        uint8_t r, g, b, a;
+    };
+    std::vector<Vertex> vertices;
+    std::vector<GL::GLuint> indices;
+    std::vector<int> segments;
+    // то же для instancedRenderer, по экземпляру на метеор
+    std::vector<MeteorInstance> instances;
+
+    MeteorPool(uint64_t seed): random(seed) {}
+
+    size_t size() const { return x.size(); }
+
+    void spawn() {
+        x.push_back(0.15f + random.uniform()*0.7f);
+        y.push_back(1 + random.uniform()*0.2f);
+        dx.push_back((random.uniform()*2 - 1)*0.1f);
+        dy.push_back(-0.1f - random.uniform()*0.5f);
+        speed.push_back(7 + 3*random.uniform());
+        radius.push_back(0.01f + random.uniform()*0.01f);
+        r.push_back(0.8f + 0.2f*random.uniform());
+        g.push_back(0.08f*random.uniform());
+        b.push_back(0.08f*random.uniform());
+    }
+
+    void remove_at(size_t i) {
+        for (auto* field: {&x, &y, &dx, &dy, &speed, &radius, &r, &g, &b}) {
+            (*field)[i] = field->back();
+            field->pop_back();
+        }
+    }
+
+    bool update(std::shared_ptr<State> state) override {
+        size_t n = size();
+        noise.resize((n + LaneRandom::lanes - 1) / LaneRandom::lanes * LaneRandom::lanes);
+        for (size_t i=0; i<noise.size(); i += LaneRandom::lanes) {
+            random.next(&noise[i]);
+        }
+
+        float dt = state->dt;
+        float* __restrict px = x.data();
+        float* __restrict py = y.data();
+        float* __restrict pr = radius.data();
+        const float* __restrict pdx = dx.data();
+        const float* __restrict pdy = dy.data();
+        const float* __restrict ps = speed.data();
+        const float* __restrict pn = noise.data();
+        #pragma GCC ivdep
+        for (size_t i=0; i<n; i++) {
+            float step = dt*ps[i];
+            px[i] += pdx[i]*step;
+            py[i] += pdy[i]*step;
+            pr[i] *= 1 + 0.1f*(pn[i]*2 - 1);
+        }
+
+        for (size_t i=0; i<size(); ) {
+            if (y[i] + radius[i] < 0) remove_at(i);
+            else i++;
+        }
         return true;
     }
 
+    void build(std::shared_ptr<DrawingContext> context) {
+        // сначала подробность каждого метеора и общий размер массивов
+        segments.resize(size());
+        size_t vertex_count = 0, index_count = 0;
+        for (size_t i=0; i<size(); i++) {
+            double radii = std::max(context->transform_x(radius[i]), context->transform_y(radius[i]));
+            int n = unit_circle(circle_segments(radii)).size() - 1;
+            segments[i] = n;
+            vertex_count += n + 2;
+            index_count += 3*n;
+        }
+        vertices.resize(vertex_count);
+        indices.resize(index_count);
+
+        Vertex* v = vertices.data();
+        GL::GLuint* index = indices.data();
+        float sx = context->size.x, sy = context->size.y;
+        float ox = context->lefttop.x, oy = context->lefttop.y;
+        for (size_t i=0; i<size(); i++) {
+            auto& circle = unit_circle(segments[i]);
+            float cx = ox + x[i]*sx, cy = oy + y[i]*sy;
+            float rx = radius[i]*sx, ry = radius[i]*sy;
+            uint8_t cr = r[i]*255 + 0.5f, cg = g[i]*255 + 0.5f, cb = b[i]*255 + 0.5f;
+
+            // центр и n+1 точка окружности, последняя совпадает с первой
+            GL::GLuint base = v - vertices.data();
+            *v++ = {cx, cy, cr, cg, cb, 255};
+            for (auto& p: circle) *v++ = {cx + (float)p.x*rx, cy + (float)p.y*ry, cr, cg, cb, 255};
+            for (int k=0; k<segments[i]; k++) {
+                *index++ = base;
+                *index++ = base + 1 + k;
+                *index++ = base + 2 + k;
+            }
+        }
+    }
+
+    void place(std::shared_ptr<DrawingContext> context) {
+        instances.resize(size());
+        float sx = context->size.x, sy = context->size.y;
+        float ox = context->lefttop.x, oy = context->lefttop.y;
+        for (size_t i=0; i<size(); i++) {
+            uint8_t cr = r[i]*255 + 0.5f, cg = g[i]*255 + 0.5f, cb = b[i]*255 + 0.5f;
+            instances[i] = {ox + x[i]*sx, oy + y[i]*sy, radius[i]*sx, radius[i]*sy, cr, cg, cb, 255};
+        }
+    }
+
     void draw(std::shared_ptr<DrawingContext> context) override {
-        circle->draw(context);
+        if (instanced) {
+            place(context);
+            instancedRenderer.draw(instances);
+            return;
+        }
+
+        build(context);
+        if (indices.empty()) return;
+
+        GL::glEnableClientState(GL_VERTEX_ARRAY);
+        GL::glEnableClientState(GL_COLOR_ARRAY);
+        GL::glVertexPointer(2, GL_FLOAT, sizeof(Vertex), &vertices[0].x);
+        GL::glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), &vertices[0].r);
+        GL::glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, indices.data());
+        GL::glDisableClientState(GL_VERTEX_ARRAY);
+        GL::glDisableClientState(GL_COLOR_ARRAY);
     }
 };
 
@@ -428,6 +697,7 @@ public:
 std::shared_ptr<State> state;
 std::shared_ptr<DrawingContext> context;
 std::shared_ptr<Stage> main_stage;
+std::shared_ptr<MeteorPool> meteors;
 
 void keyboardKeys(unsigned char key, int x, int y) {
     switch (key) {
@@ -442,23 +712,8 @@ void keyboardKeys(unsigned char key, int x, int y) {
             }
             break;
         case 'M': case 'm': 
-        {// create meteor
-            Point pos = Point(0.15 + drand()*0.7, 1 + drand()*0.2);
-            Point direction = Point( (drand()*2-1)*0.1 , -0.1 - drand()*0.5 );
-            Color color = {0.8 + 0.2*drand(), 0.08*drand(), 0.08*drand(), 1};
-            double speed = 7 + 3*drand();
-            double radius = 0.01 + drand()*0.01;
-
-            std::shared_ptr<Circle> circle(
-                new Circle(pos, radius, color)
-            );
-            std::shared_ptr<Meteor> meteor(
-                new Meteor(circle, direction, speed)
-            );
-
-            main_stage->add_updatie(meteor);
-            main_stage->add_drawie(meteor);
-        } break;
+            meteors->spawn();
+            break;
         default:
             break;
     }
@@ -490,8 +745,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
     
     {// Sun & Moon
@@ -505,8 +759,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(sun);
-        main_stage->add_drawie(sun);
+        main_stage->add(sun);
 
         std::shared_ptr<RotatingAnimation> moon(
             new RotatingAnimation( 
@@ -517,8 +770,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(moon);
-        main_stage->add_drawie(moon);
+        main_stage->add(moon);
     }
 
     
@@ -539,8 +791,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
 
     {// House
@@ -559,8 +810,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
     
     {// House roof
@@ -585,8 +835,7 @@ void prepare() {
         );
         
         
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
 
     {// House
@@ -605,8 +854,7 @@ void prepare() {
                 )
             );
     
-            main_stage->add_updatie(anim);
-            main_stage->add_drawie(anim);
+            main_stage->add(anim);
         }
 
     {// House roof
@@ -631,9 +879,12 @@ void prepare() {
         );
         
         
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
+
+    // метеоры рисуются поверх сцены
+    meteors.reset(new MeteorPool(time(0)));
+    main_stage->add(meteors);
 }
 
 void draw() {
@@ -648,20 +899,115 @@ void draw() {
 }
 
 void update() {
-    using namespace std::chrono;
-    
-    auto start = steady_clock::now();
-    main_stage->update( state );
+    // столько шагов по state->dt, сколько прошло реального времени
+    scheduler.advance([](double) {
+        main_stage->update(state);
+    });
     draw();
-    auto end = steady_clock::now();
-    
-    double dur = duration_cast<microseconds>(end-start).count();
-    if (dur < delaytime)
-        usleep(delaytime - dur);
+    scheduler.wait();
+}
+
+// Без окна: count метеоров живут steps шагов, сгоревшие сразу
+// заменяются новыми. Время - обновление пула вместе с новыми метеорами,
+// сборка их вершин и их экземпляров для отрисовки; самой отрисовки здесь
+// нет, её меряет режим draw.
+int meteor_bench(long count, long steps) {
+    State bench_state = {0, 1/FPS, false};
+    auto shared_state = std::make_shared<State>(bench_state);
+    auto bench_context = std::make_shared<DrawingContext>();
+    bench_context->lefttop = {0,0};
+    bench_context->size = {(double)WINX, (double)WINY};
+    MeteorPool pool(time(0));
+    while ((long)pool.size() < count) pool.spawn();
+
+    long respawned = 0;
+    double update_ms = 0, build_ms = 0, place_ms = 0;
+    for (long step=0; step<steps; step++) {
+        auto start = std::chrono::steady_clock::now();
+        pool.update(shared_state);
+        for (; (long)pool.size() < count; respawned++) pool.spawn();
+        auto updated = std::chrono::steady_clock::now();
+        pool.build(bench_context);
+        auto built = std::chrono::steady_clock::now();
+        pool.place(bench_context);
+        update_ms += std::chrono::duration<double, std::milli>(updated - start).count();
+        build_ms += std::chrono::duration<double, std::milli>(built - updated).count();
+        place_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - built).count();
+    }
+    update_ms /= steps;
+    build_ms /= steps;
+    place_ms /= steps;
+    std::printf("%ld meteors, %ld steps: update %.3f ms, geometry %.3f ms (%zu vertices, %zu KB), instances %.3f ms (%zu KB), %ld respawned\n",
+        count, steps, update_ms, build_ms, pool.vertices.size(),
+        (pool.vertices.size()*sizeof(MeteorPool::Vertex) + pool.indices.size()*sizeof(GL::GLuint)) / 1024,
+        place_ms, pool.instances.size()*sizeof(MeteorInstance) / 1024, respawned);
+    return 0;
+}
+
+// В окне: кадры подряд без ожидания, до glFinish, чтобы время включало
+// отрисовку; сгоревшие метеоры заменяются, чтобы их было drawMeteors.
+// После drawFrames кадров печатает итог и выходит.
+long drawMeteors = 0;
+int drawFrames = 0, drawDone = 0;
+double drawMs = 0;
+
+void draw_bench() {
+    auto start = std::chrono::steady_clock::now();
+    main_stage->update(state);
+    while ((long)meteors->size() < drawMeteors) meteors->spawn();
+    draw();
+    GL::glFinish();
+    drawMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (++drawDone == drawFrames) {
+        if (instanced) std::printf("%ld meteors: %.3f ms/frame (%.0f FPS), instanced\n",
+            drawMeteors, drawMs/drawFrames, 1000*drawFrames/drawMs);
+        else std::printf("%ld meteors: %.3f ms/frame (%.0f FPS), %zu vertices/frame\n",
+            drawMeteors, drawMs/drawFrames, 1000*drawFrames/drawMs, meteors->vertices.size());
+        std::exit(0);
+    }
+}
+
+// Без окна: сцена из prepare(), в пул которой рождаются и сгорают total
+// метеоров. Массивы пула должны выйти на плато, а не расти вместе с их
+// числом, а объекты сцены - остаться в хранилище сцены.
+int stress(long total) {
+    prepare();
+    state->dt = 1/FPS;
+    size_t scene_objects = main_stage->objects.size();
+
+    const int per_step = 100;
+    long spawned = 0, steps = 0;
+    size_t max_live = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (spawned < total || meteors->size() > 0) {
+        for (int i=0; i<per_step && spawned < total; i++, spawned++) {
+            meteors->spawn();
+        }
+        max_live = std::max(max_live, meteors->size());
+        main_stage->update(state);
+        steps++;
+
+        if (steps % 2000 == 0 || meteors->size() == 0) {
+            std::printf("%8ld spawned, %6zu live, capacity %6zu, scene objects %zu\n",
+                spawned, meteors->size(), meteors->x.capacity(), main_stage->objects.size());
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%ld meteors, %ld steps, %.2f s, at most %zu live at once\n", total, steps, seconds, max_live);
+
+    // массивы пула растут удвоением, так что больше двух пиков быть не может
+    bool plateau = meteors->x.capacity() <= 2*max_live;
+    return plateau && main_stage->objects.size() == scene_objects ? 0 : 1;
 }
 
 int main(int argc, char** argv) {
     srand(time(0));
+    if (argc > 1 && std::strcmp(argv[1], "stress") == 0) {
+        return stress(argc > 2 ? std::atol(argv[2]) : 1000000);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "meteors") == 0) {
+        return meteor_bench(argc > 2 ? std::atol(argv[2]) : 100000, argc > 3 ? std::atol(argv[3]) : 1000);
+    }
     prepare();
 
     // glut
@@ -670,13 +1016,23 @@ int main(int argc, char** argv) {
     GL::glutInitWindowSize(WINX,WINY);
     GL::glutInitWindowPosition(100, 100);
     GL::glutCreateWindow("Laba");
+    GL::glewInit();
     GL::glClearColor(1, 1, 1, 0);
 
     GL::glMatrixMode(GL_PROJECTION);
     GL::glLoadIdentity();
     
     GL::glOrtho(0, WINX, 0, WINY, 0, 1);
-    GL::glutDisplayFunc(update);
+
+    bool draw_mode = argc > 1 && std::strcmp(argv[1], "draw") == 0;
+    // draw ... vertices: для сравнения без экземпляров
+    instanced = !(draw_mode && argc > 4 && std::strcmp(argv[4], "vertices") == 0) && instancedRenderer.init();
+    if (draw_mode) {
+        drawMeteors = argc > 2 ? std::atol(argv[2]) : 100000;
+        drawFrames = argc > 3 ? std::atoi(argv[3]) : 100;
+        GL::glutDisplayFunc(draw_bench);
+    }
+    else GL::glutDisplayFunc(update);
     GL::glutReshapeFunc(reshape);
     GL::glutKeyboardFunc(keyboardKeys);
 
@@ -0,0 +1,53 @@
+// Замеры lab2, которым нужен подсчёт выделений памяти. Счётчик подменяет
+// operator new всего процесса, поэтому живёт здесь, а не в программе с окном.
+#define LAB2_BENCH
+#include "main.cpp"
+
+#include <new>
+
+long allocations = 0;
+
+// не встраивать ни new, ни delete: иначе GCC видит malloc() и free() по
+// разные стороны и считает их несовпадающей парой
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocations++;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+// Без окна: сцена из prepare() и meteors метеоров, сколько выделений
+// памяти и времени уходит на update и сборку кадра после разгона.
+// Сцена без метеоров не должна выделять ничего; метеор выделяет, только
+// когда его радиус впервые дорастает до более подробного разбиения.
+int frame_bench(long meteors, int frames) {
+    prepare();
+    for (long i=0; i<meteors; i++) main_stage->add(make_meteor());
+    context->lefttop = {0,0};
+    context->size = {(double)WINX, (double)WINY};
+    for (int f=0; f<10; f++) {
+        main_stage->update(state);
+        main_stage->draw(context);
+    }
+
+    long before = allocations;
+    auto start = std::chrono::steady_clock::now();
+    for (int f=0; f<frames; f++) {
+        main_stage->update(state);
+        main_stage->draw(context);
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+    long count = allocations - before;
+    std::printf("scene + %ld meteors: %.3f ms/frame, %ld allocations in %d frames\n", meteors, ms, count, frames);
+    return meteors > 0 || count == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    srand(time(0));
+    if (argc > 1 && std::strcmp(argv[1], "frame") == 0) {
+        return frame_bench(argc > 2 ? std::atol(argv[2]) : 0, argc > 3 ? std::atoi(argv[3]) : 100);
+    }
+    std::fprintf(stderr, "usage: bench frame [meteors] [frames]\n");
+    return 1;
+}
@@ -9,6 +9,15 @@
 #include <algorithm>
 
 #include <memory>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+
+#include "../lab0/frame_scheduler.hpp"
+#include "../lab0/object_store.hpp"
+#include "../lab0/circle_tables.hpp"
 
 namespace GL {
     #include <GL/glew.h>
@@ -40,6 +49,7 @@ struct Point {
     Point operator*(double k) {
         return Point(k*x, k*y);
     }
+    bool operator==(const Point& other) const = default;
 };
 struct Color {
     double r, g, b;
@@ -51,27 +61,56 @@ struct Color {
     Color operator*(double k) {
         return Color{r*k, g*k, b*k, a};
     }
+    bool operator==(const Color& other) const = default;
+};
+
+// Вершина в GL-буфере: координаты во float и цвет в RGBA8, 12 байт
+// вместо 48 у пары Point и Color. Считается сцена по-прежнему в double.
+struct Vertex {
+    float x, y;
+    uint8_t r, g, b, a;
+
+    Vertex() = default;
+    Vertex(Point p, Color c): x(p.x), y(p.y), r(channel(c.r)), g(channel(c.g)), b(channel(c.b)), a(channel(c.a)) {}
+
+    static uint8_t channel(double v) {
+        return v <= 0 ? 0 : v >= 1 ? 255 : (uint8_t)(v*255 + 0.5);
+    }
 };
+static_assert(sizeof(Vertex) == 12);
+
+// Экземпляр сетки из MeshBank: точка сетки p рисуется в
+// origin + axis_x*p.x + axis_y*p.y, вся сетка одним цветом.
+struct Instance {
+    float ax, ay, bx, by, x, y;
+    uint8_t r, g, b, a;
+
+    Instance() = default;
+    Instance(Point axis_x, Point axis_y, Point origin, Color c):
+        ax(axis_x.x), ay(axis_x.y), bx(axis_y.x), by(axis_y.y), x(origin.x), y(origin.y),
+        r(Vertex::channel(c.r)), g(Vertex::channel(c.g)), b(Vertex::channel(c.b)), a(Vertex::channel(c.a)) {}
+
+    bool operator==(const Instance& other) const = default;
+};
+static_assert(sizeof(Instance) == 28);
 
 double FPS = 60.0f;
 double delaytime = 1000000.0f/FPS;
+// шаг симуляции равен state->dt, кадры - по абсолютным дедлайнам
+FrameScheduler scheduler(FPS);
 
 void setFPS(double nFPS) {
     if (nFPS <= 0) return;
     FPS = nFPS;
     delaytime = 1000000/nFPS;
+    scheduler.set_fps(nFPS);
+    scheduler.set_step(1/nFPS);
 }
 
 
 int WINX = 1200;
 int WINY = 700;
 
-GL::GLuint vertexBuffer = 0;
-GL::GLuint colorBuffer = 0;
-std::vector<GL::GLsizei> vertexCounts;
-std::vector<Point> allPoints;
-std::vector<Color> allColors;
-
 void reshape(int width, int height) {
     GL::glutReshapeWindow(WINX, WINY);
 }
@@ -81,56 +120,34 @@ void force_reshape(int width, int height) {
 }
 
 
-std::pair <
-    std::vector<Point>,
-    std::vector<Color>
-> draw_filled_ellipse(Point center, Point radii, Color color, int shapeness) {
-    std::pair<std::vector<Point>, std::vector<Color> > result;
-    
-    double koef = (2 * M_PI) / shapeness;
+// Функции ниже дописывают вершины веера в sink, который передаёт
+// вызывающий: память в нём остаётся от прошлых кадров.
+void draw_filled_ellipse(std::vector<Point>& sink, Point center, Point radii, int shapeness) {
+    auto& circle = unit_circle(shapeness);
     
-    result.first.push_back(center);
-    result.second.push_back(color);
+    sink.push_back(center);
     
-    for (int i = 0; i <= shapeness; i++) {
-        double angle = i * koef;
-        result.first.push_back(Point(
-            center.x + cos(angle) * radii.x,
-            center.y + sin(angle) * radii.y
+    for (auto& p: circle) {
+        sink.push_back(Point(
+            center.x + p.x * radii.x,
+            center.y + p.y * radii.y
         ));
-        result.second.push_back(color);
     }
-    
-    return result;
 }
 
-std::pair<std::vector<Point>, std::vector<Color> > 
-draw_filled_rect(Point point, double width, double height, Color color) {
-    std::pair<std::vector<Point>, std::vector<Color> > result;
-    
+void draw_filled_rect(std::vector<Point>& sink, Point point, double width, double height) {
     Point center(point.x + width/2, point.y + height/2);
-    result.first.push_back(center);
-    result.second.push_back(color);
-    
-    result.first.push_back(Point(point.x, point.y));
-    result.second.push_back(color);
-    result.first.push_back(Point(point.x + width, point.y));
-    result.second.push_back(color);
-    result.first.push_back(Point(point.x + width, point.y + height));
-    result.second.push_back(color);
-    result.first.push_back(Point(point.x, point.y + height));
-    result.second.push_back(color);
-    result.first.push_back(Point(point.x, point.y)); 
-    result.second.push_back(color);
+    sink.push_back(center);
     
-    return result;
+    sink.push_back(Point(point.x, point.y));
+    sink.push_back(Point(point.x + width, point.y));
+    sink.push_back(Point(point.x + width, point.y + height));
+    sink.push_back(Point(point.x, point.y + height));
+    sink.push_back(Point(point.x, point.y)); 
 }
 
-std::pair<std::vector<Point>, std::vector<Color> > 
-draw_filled_poly(std::vector<Point> &points, Color color) {
-    std::pair<std::vector<Point>, std::vector<Color> > result;
-    
-    if (points.size() < 3) return result;
+void draw_filled_poly(std::vector<Point>& sink, const std::vector<Point> &points) {
+    if (points.size() < 3) return;
     
     Point center(0, 0);
     for (const auto& p : points) {
@@ -140,19 +157,115 @@ draw_filled_poly(std::vector<Point> &points, Color color) {
     center.x /= points.size();
     center.y /= points.size();
     
-    result.first.push_back(center);
-    result.second.push_back(color);
+    sink.push_back(center);
     
     for (const auto& p : points) {
-        result.first.push_back(p);
-        result.second.push_back(color);
+        sink.push_back(p);
     }
-    result.first.push_back(points[0]);
-    result.second.push_back(color);
-    
-    return result;
+    sink.push_back(points[0]);
 }
 
+// Сетки для рисования экземплярами: веера в своих координатах, которые
+// попадают в GL один раз, а дальше только сдвигаются, масштабируются и
+// красятся через Instance. Круг - квадрат [-1, 1], в котором шейдер
+// вырезает единичный круг, прямоугольник - единичный квадрат,
+// многоугольник - свои точки сцены.
+class MeshBank {
+public:
+    struct Mesh {
+        size_t first, count;
+    };
+
+    std::vector<float> coords;  // x, y всех сеток подряд
+    size_t version = 0;         // растёт при каждом изменении coords
+    int disc, quad;
+
+private:
+    std::vector<Mesh> meshes;
+    std::vector<Point> fan;
+
+public:
+    MeshBank() {
+        disc = set(-1, {Point(-1, -1), Point(1, -1), Point(1, 1), Point(-1, 1)});
+        fan.clear();
+        draw_filled_rect(fan, Point(0, 0), 1, 1);
+        quad = set(-1, fan);
+    }
+
+    // Пишет веер в сетку id, если тот же размер, иначе заводит новую;
+    // возвращает номер сетки. Прежняя сетка другого размера остаётся.
+    int set(int id, const std::vector<Point>& points) {
+        if (id < 0 || meshes[id].count != points.size()) {
+            id = meshes.size();
+            meshes.push_back({coords.size()/2, points.size()});
+            coords.resize(coords.size() + 2*points.size());
+        }
+        float* out = coords.data() + 2*meshes[id].first;
+        for (auto& p: points) {
+            *out++ = p.x;
+            *out++ = p.y;
+        }
+        version++;
+        return id;
+    }
+
+    const Mesh& get(int id) const {
+        return meshes[id];
+    }
+};
+
+MeshBank meshes;
+
+// Экземпляры кадра по порядку рисования. Подряд идущие экземпляры одной
+// сетки собираются в прогон, который рисуется одним вызовом, так что
+// порядок наложения не меняется.
+class InstanceBatch {
+public:
+    struct Run {
+        int mesh;
+        size_t first, count;
+    };
+
+    std::vector<Instance> instances;
+    std::vector<Run> runs;
+    // изменённые с прошлого кадра экземпляры, [first, end)
+    std::vector< std::pair<size_t, size_t> > dirty;
+
+private:
+    size_t size = 0;
+
+    void mark(size_t i) {
+        if (!dirty.empty() && dirty.back().second == i) dirty.back().second++;
+        else dirty.push_back({i, i + 1});
+    }
+
+public:
+    void begin() {
+        size = 0;
+        runs.clear();
+        dirty.clear();
+    }
+
+    void add(int mesh, const Instance& instance) {
+        if (size == instances.size()) {
+            instances.push_back(instance);
+            mark(size);
+        }
+        else if (!(instances[size] == instance)) {
+            instances[size] = instance;
+            mark(size);
+        }
+
+        if (!runs.empty() && runs.back().mesh == mesh) runs.back().count++;
+        else runs.push_back({mesh, size, 1});
+        size++;
+    }
+
+    void end() {
+        instances.resize(size);
+    }
+};
+
 struct State {
     double t;
     double dt;
@@ -191,80 +304,137 @@ public:
     virtual bool update(std::shared_ptr < State > state) { return true; }
 };
 
+// Вершины объекта, которые живут между кадрами. Объект перестраивает их,
+// только когда изменились его форма, положение или цвет, и отмечает это
+// флагами; Stage сбрасывает флаги, забрав изменения в общий буфер.
+struct Geometry {
+    std::vector<Point> points;
+    std::vector<Color> colors;
+    bool points_dirty = true;
+    bool colors_dirty = true;
+
+    // пустой приёмник для новых вершин, с памятью от прошлых
+    std::vector<Point>& rebuild_points() {
+        points.clear();
+        points_dirty = true;
+        return points;
+    }
+
+    void set_color(Color color) {
+        colors.reserve(points.capacity());  // и цвета с тем же запасом
+        colors.assign(points.size(), color);
+        colors_dirty = true;
+    }
+};
+
 class DrawableObject {
 public:
-    virtual std::pair <
-        std::vector<Point>,
-        std::vector<Color>
-    > draw(std::shared_ptr < DrawingContext > context) = 0;
+    virtual Geometry& draw(std::shared_ptr < DrawingContext > context) = 0;
+    // то же для рисования экземплярами: добавляет свои экземпляры в batch
+    virtual void place(std::shared_ptr < DrawingContext > context, InstanceBatch& batch) = 0;
 };
 
 class ComplexObject: public UpdatableObject, public DrawableObject {};
 
-class Stage: public ComplexObject {
-public:
-    std::vector< std::shared_ptr<UpdatableObject> > updaties;
-    std::vector< std::shared_ptr<DrawableObject> > drawies;
+// Сцена не вкладывается в другие объекты, поэтому она только
+// UpdatableObject: draw() отдаёт готовые вершины для GL-буфера.
+class Stage: public UpdatableObject {
+    // где лежали вершины объекта в прошлом кадре
+    struct Range {
+        const Geometry* source;
+        size_t first, count;
+    };
+    std::vector<Range> layout;
+
+    void mark(size_t first, size_t count) {
+        if (!dirty.empty() && dirty.back().second == first) dirty.back().second += count;
+        else dirty.push_back({first, first + count});
+    }
 
-    void add_updatie(std::shared_ptr<UpdatableObject> obj) {
-        updaties.push_back(obj);
+public:
+    // один handle на объект: он обновляется и рисуется, пока update не вернёт false
+    using Store = ObjectStore< std::shared_ptr<ComplexObject> >;
+    using Handle = Store::Handle;
+    Store objects;
+
+    // вершины всей сцены и изменённые в последнем draw() диапазоны [first, end)
+    std::vector<Vertex> vertices;
+    std::vector< std::pair<size_t, size_t> > dirty;
+    // веер каждого объекта для glMultiDrawArrays: вся сцена одним вызовом
+    std::vector<GL::GLint> firsts;
+    std::vector<GL::GLsizei> counts;
+    InstanceBatch batch;
+
+    Handle add(std::shared_ptr<ComplexObject> obj) {
+        return objects.add(obj);
     }
 
-    void add_drawie(std::shared_ptr<DrawableObject> obj) {
-        drawies.push_back(obj);
+    bool remove(Handle handle) {
+        return objects.remove(handle);
     }
 
     bool update(std::shared_ptr<State> state) override {
-        std::vector<void*> to_remove;
-        for (auto& obj: updaties) {
-            if (obj->update(state) == false) {
-                to_remove.push_back(obj.get());
-            }
-        }
-        for (void* ptr: to_remove) {
-            auto it = std::find_if(updaties.begin(), updaties.end(),
-                [ptr](const std::shared_ptr<UpdatableObject>& sp) {
-                    return sp.get() == ptr;
-                });
-            if (it != updaties.end()) {
-                updaties.erase(it);
-            }
+        // на место удалённого встаёт последний объект, он ещё не обновлён;
+        // объекты сцены добавлены раньше метеоров, их порядок не меняется
+        for (size_t i=0; i<objects.size(); ) {
+            if (objects[i]->update(state)) i++;
+            else objects.remove_at(i);
         }
         return true;
     }
 
-    std::pair <
-        std::vector<Point>,
-        std::vector<Color>
-    > draw(std::shared_ptr<DrawingContext> context) override {
-        std::pair <
-            std::vector<Point>,
-            std::vector<Color>
-        > result;
-        
-        for (auto& obj: drawies) {
-            auto current = obj->draw(context);
-
-            vertexCounts.push_back(current.first.size());
-
-            result.first.insert(
-                result.first.end(),
-                current.first.begin(),
-                current.first.end()
-            );
-
-            result.second.insert(
-                result.second.end(),
-                current.second.begin(),
-                current.second.end()
-            );
+    // Собирает вершины объектов друг за другом. Переводятся в Vertex
+    // только изменившиеся и те, что сдвинулись или сменили соседа после
+    // удаления.
+    std::vector<Vertex>& draw(std::shared_ptr<DrawingContext> context) {
+        dirty.clear();
+        firsts.clear();
+        counts.clear();
+
+        size_t offset = 0, i = 0;
+        for (auto& obj: objects) {
+            Geometry& current = obj->draw(context);
+            size_t count = current.points.size();
+            bool moved = i >= layout.size() || layout[i].source != &current
+                || layout[i].first != offset || layout[i].count != count;
+
+            if (vertices.size() < offset + count) vertices.resize(offset + count);
+            if (moved || current.points_dirty || current.colors_dirty) {
+                for (size_t k=0; k<count; k++) {
+                    vertices[offset + k] = Vertex(current.points[k], current.colors[k]);
+                }
+                mark(offset, count);
+            }
+            current.points_dirty = current.colors_dirty = false;
+
+            if (i < layout.size()) layout[i] = {&current, offset, count};
+            else layout.push_back({&current, offset, count});
+            firsts.push_back(offset);
+            counts.push_back(count);
+            offset += count;
+            i++;
         }
+        layout.resize(i);
+        vertices.resize(offset);
+
+        return vertices;
+    }
 
-        return result;
+    // Вместо вершин собирает по экземпляру сетки на фигуру.
+    InstanceBatch& place(std::shared_ptr<DrawingContext> context) {
+        batch.begin();
+        for (auto& obj: objects) obj->place(context, batch);
+        batch.end();
+        return batch;
     }
 };
 
 class Polygon: public ComplexObject {
+    Geometry geometry;
+    std::vector<Point> drawn_points, screen_points;
+    Point drawn_lefttop, drawn_size;
+    int mesh = -1;
+    std::vector<Point> mesh_points, fan;
 public:
     std::vector<Point> points;
     Color color;
@@ -276,20 +446,38 @@ public:
     Polygon(std::vector<Point> &points, Color color): points(points), color(color) {}
     Polygon(std::vector<Point> &points, Color color, double linewidth): points(points), color(color), filled(false), linewidth(linewidth) {}
 
-    std::pair <
-        std::vector<Point>,
-        std::vector<Color>
-    > draw(std::shared_ptr<DrawingContext> context) override {
-        std::vector<Point> temp_points = points;
-        for (auto &point: temp_points) {
-            point = context->transform(point);
+    Geometry& draw(std::shared_ptr<DrawingContext> context) override {
+        bool moved = geometry.points.empty() || drawn_points != points
+            || !(drawn_lefttop == context->lefttop) || !(drawn_size == context->size);
+        if (moved) {
+            screen_points.resize(points.size());
+            for (size_t i=0; i<points.size(); i++) {
+                screen_points[i] = context->transform(points[i]);
+            }
+            draw_filled_poly(geometry.rebuild_points(), screen_points);
+            drawn_points = points;
+            drawn_lefttop = context->lefttop;
+            drawn_size = context->size;
         }
+        if (moved || !(geometry.colors[0] == color)) geometry.set_color(color);
+        return geometry;
+    }
 
-        return draw_filled_poly(temp_points, color);
+    void place(std::shared_ptr<DrawingContext> context, InstanceBatch& batch) override {
+        if (mesh < 0 || mesh_points != points) {
+            fan.clear();
+            draw_filled_poly(fan, points);
+            mesh = meshes.set(mesh, fan);
+            mesh_points = points;
+        }
+        if (fan.empty()) return;
+        batch.add(mesh, Instance(Point(context->size.x, 0), Point(0, context->size.y), context->lefttop, color));
     }
 };
 
 class Rectangle: public ComplexObject {
+    Geometry geometry;
+    Point drawn_lefttop, drawn_size;
 public:
     Point lefttop;
     Point size;
@@ -302,15 +490,28 @@ public:
     Rectangle(Point lefttop, Point size, Color color): lefttop(lefttop), size(size), color(color) {}
     Rectangle(Point lefttop, Point size, Color color, double linewidth): lefttop(lefttop), size(size), color(color), filled(false), linewidth(linewidth) {}
 
-    std::pair <
-        std::vector<Point>,
-        std::vector<Color>
-    > draw(std::shared_ptr<DrawingContext> context) override {
-        return draw_filled_rect(context->transform(lefttop), context->transform_x(size.x), context->transform_y(size.y), color);
+    Geometry& draw(std::shared_ptr<DrawingContext> context) override {
+        Point corner = context->transform(lefttop);
+        Point extent(context->transform_x(size.x), context->transform_y(size.y));
+        bool moved = geometry.points.empty() || !(drawn_lefttop == corner) || !(drawn_size == extent);
+        if (moved) {
+            draw_filled_rect(geometry.rebuild_points(), corner, extent.x, extent.y);
+            drawn_lefttop = corner;
+            drawn_size = extent;
+        }
+        if (moved || !(geometry.colors[0] == color)) geometry.set_color(color);
+        return geometry;
+    }
+
+    void place(std::shared_ptr<DrawingContext> context, InstanceBatch& batch) override {
+        Point extent(context->transform_x(size.x), context->transform_y(size.y));
+        batch.add(meshes.quad, Instance(Point(extent.x, 0), Point(0, extent.y), context->transform(lefttop), color));
     }
 };
 
 class Circle: public ComplexObject {
+    Geometry geometry;
+    Point drawn_center, drawn_radii;
 public:
     Point center;
     double radius;
@@ -323,13 +524,26 @@ public:
     Circle(Point center, double radius, Color color): center(center), radius(radius), color(color) {}
     Circle(Point center, double radius, Color color, double linewidth): center(center), radius(radius), color(color), filled(false), linewidth(linewidth) {}
 
-    std::pair <
-        std::vector<Point>,
-        std::vector<Color>
-    > draw(std::shared_ptr<DrawingContext> context) override {
-        // std::cout << "Circle " << std::endl;
+    Geometry& draw(std::shared_ptr<DrawingContext> context) override {
+        Point screen_center = context->transform(center);
+        Point radii(context->transform_x(radius), context->transform_y(radius));
+        bool moved = geometry.points.empty() || !(drawn_center == screen_center) || !(drawn_radii == radii);
+        if (moved) {
+            int segments = circle_segments(std::max(radii.x, radii.y));
+            auto& sink = geometry.rebuild_points();
+            // с запасом на уровень подробнее: радиус метеора меняется каждый шаг
+            if (sink.capacity() < (size_t)segments + 2) sink.reserve(2*segments + 2);
+            draw_filled_ellipse(sink, screen_center, radii, segments);
+            drawn_center = screen_center;
+            drawn_radii = radii;
+        }
+        if (moved || !(geometry.colors[0] == color)) geometry.set_color(color);
+        return geometry;
+    }
 
-        return draw_filled_ellipse(context->transform(center), Point(context->transform_x(radius), context->transform_y(radius)), color, 100);
+    void place(std::shared_ptr<DrawingContext> context, InstanceBatch& batch) override {
+        Point radii(context->transform_x(radius), context->transform_y(radius));
+        batch.add(meshes.disc, Instance(Point(radii.x, 0), Point(0, radii.y), context->transform(center), color));
     }
 };
 
@@ -354,15 +568,24 @@ public:
         return true;
     }
 
-    std::pair <
-        std::vector<Point>,
-        std::vector<Color>
-    > draw(std::shared_ptr<DrawingContext> context) override {
+    Geometry& draw(std::shared_ptr<DrawingContext> context) override {
         return circle->draw(context);
     }
+
+    void place(std::shared_ptr<DrawingContext> context, InstanceBatch& batch) override {
+        circle->place(context, batch);
+    }
 };
 
 class RotatingAnimation: public ComplexObject {
+    // контекст для object, создаётся один раз
+    std::shared_ptr<DrawingContext> newCtx = std::make_shared<DrawingContext>();
+
+    std::shared_ptr<DrawingContext> rotated(std::shared_ptr<DrawingContext> context) {
+        *newCtx = *context;
+        newCtx->lefttop = context->lefttop + context->scale(center) + Point(std::cos(offset), std::sin(offset))*context->transform(radius);
+        return newCtx;
+    }
 public:
     std::shared_ptr< DrawableObject > object;
 
@@ -383,18 +606,12 @@ public:
         return true;
     }
 
-    std::pair <
-        std::vector<Point>,
-        std::vector<Color>
-    > draw(std::shared_ptr<DrawingContext> context) override {
-        std::shared_ptr<DrawingContext> newCtx;
-        newCtx.reset(new DrawingContext(*context));
-
-        Point newLeftTop = context->lefttop + context->scale(center) + Point(std::cos(offset), std::sin(offset))*context->transform(radius);
-
-        newCtx->lefttop = newLeftTop;
+    Geometry& draw(std::shared_ptr<DrawingContext> context) override {
+        return object->draw(rotated(context));
+    }
 
-        return object->draw(newCtx);
+    void place(std::shared_ptr<DrawingContext> context, InstanceBatch& batch) override {
+        object->place(rotated(context), batch);
     }
 };
 
@@ -419,20 +636,39 @@ public:
         return true;
     }
 
-    std::pair <
-        std::vector<Point>,
-        std::vector<Color>
-    > draw(std::shared_ptr<DrawingContext> context) override {
+    Geometry& draw(std::shared_ptr<DrawingContext> context) override {
         Color color = color1*(1 - offset) + color2*offset; 
         object->color = color;
         return object->draw(context);
     }
+
+    void place(std::shared_ptr<DrawingContext> context, InstanceBatch& batch) override {
+        object->color = color1*(1 - offset) + color2*offset;
+        object->place(context, batch);
+    }
 };
 
 std::shared_ptr<State> state;
 std::shared_ptr<DrawingContext> context;
 std::shared_ptr<Stage> main_stage;
 
+std::shared_ptr<Meteor> make_meteor() {
+    Point pos = Point(0.15 + drand()*0.7, 1 + drand()*0.2);
+    Point direction = Point( (drand()*2-1)*0.1 , -0.1 - drand()*0.5 );
+    Color color = {0.8 + 0.2*drand(), 0.08*drand(), 0.08*drand(), 1};
+    double speed = 7 + 3*drand();
+    double radius = 0.01 + drand()*0.01;
+
+    std::shared_ptr<Circle> circle(
+        new Circle(pos, radius, color)
+    );
+    std::shared_ptr<Meteor> meteor(
+        new Meteor(circle, direction, speed)
+    );
+
+    return meteor;
+}
+
 void keyboardKeys(unsigned char key, int x, int y) {
     switch (key) {
         case ' ':
@@ -446,23 +682,8 @@ void keyboardKeys(unsigned char key, int x, int y) {
             }
             break;
         case 'M': case 'm': 
-        {// create meteor
-            Point pos = Point(0.15 + drand()*0.7, 1 + drand()*0.2);
-            Point direction = Point( (drand()*2-1)*0.1 , -0.1 - drand()*0.5 );
-            Color color = {0.8 + 0.2*drand(), 0.08*drand(), 0.08*drand(), 1};
-            double speed = 7 + 3*drand();
-            double radius = 0.01 + drand()*0.01;
-
-            std::shared_ptr<Circle> circle(
-                new Circle(pos, radius, color)
-            );
-            std::shared_ptr<Meteor> meteor(
-                new Meteor(circle, direction, speed)
-            );
-
-            main_stage->add_updatie(meteor);
-            main_stage->add_drawie(meteor);
-        } break;
+            main_stage->add(make_meteor());
+            break;
         default:
             break;
     }
@@ -494,8 +715,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
     
     {// Sun & Moon
@@ -509,8 +729,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(sun);
-        main_stage->add_drawie(sun);
+        main_stage->add(sun);
 
         std::shared_ptr<RotatingAnimation> moon(
             new RotatingAnimation( 
@@ -521,8 +740,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(moon);
-        main_stage->add_drawie(moon);
+        main_stage->add(moon);
     }
 
     
@@ -543,8 +761,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
 
     {// House
@@ -563,8 +780,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
 
     {// House roof
@@ -588,14 +804,327 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
 }
 
-void init_buffers() {
-    GL::glGenBuffers(1, &vertexBuffer);
-    GL::glGenBuffers(1, &colorBuffer);
+// Кольцо из нескольких областей под вершины кадра: кадр пишет в свою
+// область, пока GPU рисует прошлые из соседних, и fence на области не даёт
+// переписать её раньше, чем GPU дорисует. Область отстаёт от сцены на
+// столько кадров, сколько областей в кольце, поэтому в неё копируются
+// диапазоны, изменённые за эти кадры, а не вся сцена.
+// С GL 4.4 кольцо отображено в память навсегда, без него область
+// отображается на кадр с UNSYNCHRONIZED, а без map_buffer_range остаётся
+// одна область, которую правит glBufferSubData.
+class VertexRing {
+public:
+    enum Mode { PERSISTENT, UNSYNCHRONIZED, SUBDATA };
+    static constexpr int max_regions = 3;
+
+private:
+    using Ranges = std::vector< std::pair<size_t, size_t> >;
+
+    Mode mode = SUBDATA;
+    int regions = 1;
+    GL::GLuint buffer = 0;
+    size_t region = 0;          // байт в области
+    char* mapped = nullptr;     // всё кольцо в режиме PERSISTENT
+    GL::GLsync fences[max_regions] = {};
+    int current = 0;
+    int full = 0;               // сколько следующих областей залить целиком
+    Ranges history[max_regions];
+    Ranges pending;
+
+    void create(size_t bytes) {
+        region = bytes;
+        full = regions;
+        GL::glGenBuffers(1, &buffer);
+        GL::glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        if (mode == PERSISTENT) {
+            GL::GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            GL::glBufferStorage(GL_ARRAY_BUFFER, region*regions, nullptr, flags);
+            mapped = (char*)GL::glMapBufferRange(GL_ARRAY_BUFFER, 0, region*regions, flags);
+        }
+        else {
+            GL::glBufferData(GL_ARRAY_BUFFER, region*regions, nullptr, GL_DYNAMIC_DRAW);
+        }
+    }
+
+    void destroy() {
+        for (auto& fence: fences) {
+            if (!fence) continue;
+            GL::glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+            GL::glDeleteSync(fence);
+            fence = nullptr;
+        }
+        GL::glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        if (mapped) GL::glUnmapBuffer(GL_ARRAY_BUFFER);
+        GL::glDeleteBuffers(1, &buffer);
+        mapped = nullptr;
+        current = 0;
+    }
+
+    void wait(int index) {
+        if (GL::GLsync fence = fences[index]) {
+            if (GL::glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+                stalls++;
+                GL::glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+            }
+            GL::glDeleteSync(fence);
+            fences[index] = nullptr;
+        }
+    }
+
+public:
+    long stalls = 0;    // сколько раз область ещё была занята GPU
+    size_t written = 0; // байт, записанных в кольцо за всё время
+
+    void init(size_t region_bytes) {
+        bool sync = GL::GLEW_ARB_sync;
+        if (sync && GL::GLEW_ARB_buffer_storage) mode = PERSISTENT;
+        else if (sync && GL::GLEW_ARB_map_buffer_range) mode = UNSYNCHRONIZED;
+        else mode = SUBDATA;
+        regions = mode == SUBDATA ? 1 : max_regions;
+        create(region_bytes);
+    }
+
+    Mode get_mode() const { return mode; }
+
+    // Пишет кадр из bytes байт data, где с прошлого кадра изменились
+    // диапазоны dirty (в байтах), и оставляет кольцо привязанным к
+    // GL_ARRAY_BUFFER. Возвращает смещение области кадра в буфере.
+    size_t write(const char* data, size_t bytes, const Ranges& dirty) {
+        if (bytes > region) {
+            size_t grown = region;
+            while (grown < bytes) grown *= 2;
+            destroy();
+            create(grown);
+        }
+        wait(current);
+        history[current].assign(dirty.begin(), dirty.end());
+
+        GL::glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        size_t base = current*region;
+        char* target = nullptr;
+        if (mode == PERSISTENT) target = mapped + base;
+        if (mode == UNSYNCHRONIZED) {
+            target = (char*)GL::glMapBufferRange(GL_ARRAY_BUFFER, base, region, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        }
+        auto copy = [&](size_t first, size_t end) {
+            if (target) std::memcpy(target + first, data + first, end - first);
+            else GL::glBufferSubData(GL_ARRAY_BUFFER, base + first, end - first, data + first);
+            written += end - first;
+        };
+
+        if (full > 0) {
+            copy(0, bytes);
+            full--;
+        }
+        else {
+            // объединение диапазонов за кадры, на которые отстаёт область
+            pending.clear();
+            for (auto& ranges: history) pending.insert(pending.end(), ranges.begin(), ranges.end());
+            std::sort(pending.begin(), pending.end());
+            size_t first = 0, end = 0;
+            for (auto range: pending) {
+                if (range.first > end) {
+                    if (end > first) copy(first, end);
+                    first = range.first;
+                }
+                end = (std::max)(end, (std::min)(range.second, bytes));
+            }
+            if (end > first) copy(first, end);
+        }
+        if (mode == UNSYNCHRONIZED) GL::glUnmapBuffer(GL_ARRAY_BUFFER);
+        return base;
+    }
+
+    // после команд, читающих область кадра
+    void end_frame() {
+        if (mode != SUBDATA) fences[current] = GL::glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        current = (current + 1) % regions;
+    }
+};
+
+VertexRing vertexRing;
+std::vector< std::pair<size_t, size_t> > byteRanges;
+
+// Рисование экземплярами (GL 3.3): сетки из MeshBank лежат в своём
+// буфере, экземпляры идут через кольцо, как вершины, и каждый прогон
+// InstanceBatch рисуется одним glDrawArraysInstanced. Круги - это
+// четыре вершины квадрата, а форму и сглаженный край им даёт
+// фрагментный шейдер по расстоянию до окружности.
+class InstancedRenderer {
+    enum Attribute { POSITION, AXIS_X, AXIS_Y, ORIGIN, COLOR };
+
+    GL::GLuint flat = 0;    // сетка целиком одним цветом
+    GL::GLuint disc = 0;    // круг на квадрате MeshBank::disc
+    GL::GLuint mesh_buffer = 0;
+    size_t uploaded = 0;    // версия MeshBank в mesh_buffer
+    VertexRing ring;
+    std::vector< std::pair<size_t, size_t> > ranges;
+
+    static GL::GLuint compile(GL::GLenum type, const char* source) {
+        GL::GLuint shader = GL::glCreateShader(type);
+        GL::glShaderSource(shader, 1, &source, nullptr);
+        GL::glCompileShader(shader);
+        GL::GLint ok = 0;
+        GL::glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+        if (!ok) {
+            char log[1024] = "";
+            GL::glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+            std::cerr << "shader: " << log << std::endl;
+        }
+        return shader;
+    }
+
+    // 0, если программа не собралась
+    static GL::GLuint link(const char* vertex_source, const char* fragment_source) {
+        GL::GLuint program = GL::glCreateProgram();
+        GL::GLuint vertex = compile(GL_VERTEX_SHADER, vertex_source);
+        GL::GLuint fragment = compile(GL_FRAGMENT_SHADER, fragment_source);
+        GL::glAttachShader(program, vertex);
+        GL::glAttachShader(program, fragment);
+        GL::glBindAttribLocation(program, POSITION, "position");
+        GL::glBindAttribLocation(program, AXIS_X, "axis_x");
+        GL::glBindAttribLocation(program, AXIS_Y, "axis_y");
+        GL::glBindAttribLocation(program, ORIGIN, "origin");
+        GL::glBindAttribLocation(program, COLOR, "color");
+        GL::glLinkProgram(program);
+        GL::glDeleteShader(vertex);
+        GL::glDeleteShader(fragment);
+
+        GL::GLint ok = 0;
+        GL::glGetProgramiv(program, GL_LINK_STATUS, &ok);
+        if (!ok) {
+            GL::glDeleteProgram(program);
+            return 0;
+        }
+        return program;
+    }
+
+public:
+    // false, если GL старше 3.3 или программы не собрались
+    bool init() {
+        if (!GL::GLEW_VERSION_3_3) return false;
+
+        flat = link(R"(
+            #version 120
+            attribute vec2 position;
+            attribute vec2 axis_x;
+            attribute vec2 axis_y;
+            attribute vec2 origin;
+            attribute vec4 color;
+            varying vec4 v_color;
+            void main() {
+                vec2 p = origin + axis_x*position.x + axis_y*position.y;
+                gl_Position = gl_ModelViewProjectionMatrix * vec4(p, 0.0, 1.0);
+                v_color = color;
+            }
+        )", R"(
+            #version 120
+            varying vec4 v_color;
+            void main() {
+                gl_FragColor = v_color;
+            }
+        )");
+
+        // Квадрат раздут на пиксель наружу, чтобы сглаженному краю было
+        // где лечь. length(local) - 1 растёт на 1 за радиус, а fwidth
+        // переводит это в пиксели экрана, так что край шириной в пиксель
+        // при любом радиусе и сжатии эллипса.
+        disc = link(R"(
+            #version 120
+            attribute vec2 position;
+            attribute vec2 axis_x;
+            attribute vec2 axis_y;
+            attribute vec2 origin;
+            attribute vec4 color;
+            varying vec4 v_color;
+            varying vec2 local;
+            void main() {
+                local = position * (1.0 + 1.0/vec2(length(axis_x), length(axis_y)));
+                vec2 p = origin + axis_x*local.x + axis_y*local.y;
+                gl_Position = gl_ModelViewProjectionMatrix * vec4(p, 0.0, 1.0);
+                v_color = color;
+            }
+        )", R"(
+            #version 120
+            varying vec4 v_color;
+            varying vec2 local;
+            void main() {
+                float d = length(local) - 1.0;
+                float coverage = clamp(0.5 - d/fwidth(d), 0.0, 1.0);
+                if (coverage <= 0.0) discard;
+                gl_FragColor = vec4(v_color.rgb, coverage);
+            }
+        )");
+
+        if (!flat || !disc) return false;
+        GL::glGenBuffers(1, &mesh_buffer);
+        ring.init(1 << 18);
+        return true;
+    }
+
+    VertexRing::Mode get_mode() const { return ring.get_mode(); }
+
+    void draw(InstanceBatch& batch) {
+        if (batch.instances.empty()) return;
+
+        GL::glBindBuffer(GL_ARRAY_BUFFER, mesh_buffer);
+        if (uploaded != meshes.version) {
+            GL::glBufferData(GL_ARRAY_BUFFER, meshes.coords.size() * sizeof(float), meshes.coords.data(), GL_STATIC_DRAW);
+            uploaded = meshes.version;
+        }
+        GL::glEnableVertexAttribArray(POSITION);
+        GL::glVertexAttribPointer(POSITION, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+        GL::glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        ranges.clear();
+        for (auto [first, end]: batch.dirty) {
+            ranges.push_back({first * sizeof(Instance), end * sizeof(Instance)});
+        }
+        size_t base = ring.write((const char*)batch.instances.data(), batch.instances.size() * sizeof(Instance), ranges);
+        for (int attribute = AXIS_X; attribute <= COLOR; attribute++) {
+            GL::glEnableVertexAttribArray(attribute);
+            GL::glVertexAttribDivisor(attribute, 1);
+        }
+
+        for (auto& run: batch.runs) {
+            // у glDrawArraysInstanced нет первого экземпляра, его задаёт смещение
+            size_t at = base + run.first * sizeof(Instance);
+            GL::glVertexAttribPointer(AXIS_X, 2, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(at + offsetof(Instance, ax)));
+            GL::glVertexAttribPointer(AXIS_Y, 2, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(at + offsetof(Instance, bx)));
+            GL::glVertexAttribPointer(ORIGIN, 2, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)(at + offsetof(Instance, x)));
+            GL::glVertexAttribPointer(COLOR, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance), (void*)(at + offsetof(Instance, r)));
+
+            // край круга полупрозрачный, остальное рисуется как есть
+            bool round = run.mesh == meshes.disc;
+            GL::glUseProgram(round ? disc : flat);
+            if (round) GL::glEnable(GL_BLEND);
+            else GL::glDisable(GL_BLEND);
+
+            auto& mesh = meshes.get(run.mesh);
+            GL::glDrawArraysInstanced(GL_TRIANGLE_FAN, mesh.first, mesh.count, run.count);
+        }
+        ring.end_frame();
+        GL::glDisable(GL_BLEND);
+
+        for (int attribute = POSITION; attribute <= COLOR; attribute++) {
+            GL::glVertexAttribDivisor(attribute, 0);
+            GL::glDisableVertexAttribArray(attribute);
+        }
+        GL::glBindBuffer(GL_ARRAY_BUFFER, 0);
+        GL::glUseProgram(0);
+    }
+};
+
+InstancedRenderer instancedRenderer;
+bool instanced = false;
+
+void init_buffers(bool allow_instanced = true) {
+    vertexRing.init(1 << 20);
+    instanced = allow_instanced && instancedRenderer.init();
 }
 
 void draw() {
@@ -604,37 +1133,31 @@ void draw() {
     context->lefttop = {0,0};
     context->size = {(double)WINX, (double)WINY};
     
-    vertexCounts.clear();
-    allPoints.clear();
-    allColors.clear();
-    
-    auto buffers = main_stage->draw(context);
-    allPoints = buffers.first;
-    allColors = buffers.second;
+    if (instanced) {
+        instancedRenderer.draw(main_stage->place(context));
+        GL::glutSwapBuffers();
+        GL::glutPostRedisplay();
+        return;
+    }
+
+    std::vector<Vertex>& vertices = main_stage->draw(context);
     
-    if (!allPoints.empty() && !allColors.empty()) {
+    if (!vertices.empty()) {
         GL::glEnableClientState(GL_VERTEX_ARRAY);
         GL::glEnableClientState(GL_COLOR_ARRAY);
         
-        GL::glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-        GL::glBufferData(GL_ARRAY_BUFFER, 
-                        allPoints.size() * sizeof(Point), 
-                        allPoints.data(), 
-                        GL_DYNAMIC_DRAW);
-        GL::glVertexPointer(2, GL_DOUBLE, 0, 0);
+        // в кольцо попадают только диапазоны, изменённые за последние кадры
+        byteRanges.clear();
+        for (auto [first, end]: main_stage->dirty) {
+            byteRanges.push_back({first * sizeof(Vertex), end * sizeof(Vertex)});
+        }
+        size_t base = vertexRing.write((const char*)vertices.data(), vertices.size() * sizeof(Vertex), byteRanges);
+        GL::glVertexPointer(2, GL_FLOAT, sizeof(Vertex), (void*)(base + offsetof(Vertex, x)));
+        GL::glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(Vertex), (void*)(base + offsetof(Vertex, r)));
         
-        GL::glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
-        GL::glBufferData(GL_ARRAY_BUFFER, 
-                        allColors.size() * sizeof(Color), 
-                        allColors.data(), 
-                        GL_DYNAMIC_DRAW);
-        GL::glColorPointer(4, GL_DOUBLE, 0, 0);
+        GL::glMultiDrawArrays(GL_TRIANGLE_FAN, main_stage->firsts.data(), main_stage->counts.data(), main_stage->counts.size());
         
-        size_t offset = 0;
-        for (GL::GLsizei count : vertexCounts) {
-            GL::glDrawArrays(GL_TRIANGLE_FAN, offset, count);
-            offset += count;
-        }
+        vertexRing.end_frame();
         
         GL::glDisableClientState(GL_VERTEX_ARRAY);
         GL::glDisableClientState(GL_COLOR_ARRAY);
@@ -647,20 +1170,141 @@ void draw() {
 }
 
 void update() {
-    using namespace std::chrono;
-    
-    auto start = steady_clock::now();
-    main_stage->update( state );
+    // столько шагов по state->dt, сколько прошло реального времени
+    scheduler.advance([](double) {
+        main_stage->update(state);
+    });
     draw();
-    auto end = steady_clock::now();
-    
-    double dur = duration_cast<microseconds>(end-start).count();
-    if (dur < delaytime)
-        usleep(delaytime - dur);
+    scheduler.wait();
+}
+
+// Без окна: сцена из prepare() живёт frames кадров. Сколько времени
+// уходит на сборку кадра и сколько байт из него пришлось бы загрузить.
+int scene_bench(int frames, bool paused) {
+    prepare();
+    if (paused) state->dt = 0;
+    context->lefttop = {0,0};
+    context->size = {(double)WINX, (double)WINY};
+    main_stage->draw(context);  // первый кадр загружается целиком
+
+    size_t bytes = 0;
+    double ms = 0;
+    for (int f=0; f<frames; f++) {
+        main_stage->update(state);
+        auto start = std::chrono::steady_clock::now();
+        main_stage->draw(context);
+        ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        for (auto [first, end]: main_stage->dirty) bytes += (end - first) * sizeof(Vertex);
+    }
+    size_t total = main_stage->vertices.size() * sizeof(Vertex);
+    std::printf("scene%s: %.4f ms/frame, %zu of %zu bytes uploaded per frame\n",
+        paused ? " (paused)" : "", ms/frames, bytes/frames, total);
+    return 0;
+}
+
+// Без окна: сцена из prepare() и meteors метеоров, сколько вершин
+// выходит за кадр и сколько времени уходит на их построение. Перед каждым
+// кадром сцена делает шаг, иначе сохранённая геометрия не строится заново;
+// сгоревшие метеоры заменяются. Время шага не входит в замер.
+int tessellation_bench(long meteors, int frames) {
+    prepare();
+    state->dt = 1/FPS;
+    size_t scene_objects = main_stage->objects.size();
+    auto step = [&]() {
+        main_stage->update(state);
+        while (main_stage->objects.size() < scene_objects + meteors) main_stage->add(make_meteor());
+    };
+    context->lefttop = {0,0};
+    context->size = {(double)WINX, (double)WINY};
+
+    size_t vertices = 0;
+    double ms = 0;
+    for (int f=0; f<frames; f++) {
+        step();
+        auto start = std::chrono::steady_clock::now();
+        vertices = main_stage->draw(context).size();
+        ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    std::printf("scene + %ld meteors: %zu vertices/frame, %.3f ms/frame\n", meteors, vertices, ms/frames);
+
+    // то же экземплярами: сетки загружены заранее, за кадр идут только Instance
+    ms = 0;
+    for (int f=0; f<frames; f++) {
+        step();
+        auto start = std::chrono::steady_clock::now();
+        main_stage->place(context);
+        ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+    auto& batch = main_stage->batch;
+    std::printf("instanced: %zu instances in %zu draw calls, %zu bytes/frame, %.3f ms/frame\n",
+        batch.instances.size(), batch.runs.size(), batch.instances.size() * sizeof(Instance), ms/frames);
+    return 0;
+}
+
+// В окне: кадры подряд без ожидания, до glFinish, чтобы время включало
+// отрисовку. После drawFrames кадров печатает итог и выходит.
+int drawFrames = 0, drawDone = 0;
+double drawMs = 0;
+
+void draw_bench() {
+    main_stage->update(state);
+    auto start = std::chrono::steady_clock::now();
+    draw();
+    GL::glFinish();
+    drawMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (++drawDone == drawFrames) {
+        size_t calls = instanced ? main_stage->batch.runs.size() : 1;
+        std::printf("%zu objects%s: %.3f ms/frame, %zu draw calls/frame\n",
+            main_stage->objects.size(), instanced ? ", instanced" : "", drawMs/drawFrames, calls);
+        std::exit(0);
+    }
 }
 
+// Без окна: total метеоров рождаются и сгорают, а память хранилища должна
+// выйти на плато, а не расти вместе с их числом.
+int stress(long total) {
+    state.reset(new State);
+    main_stage.reset(new Stage);
+    state->dt = 1/FPS;
+    state->t = 0;
+
+    const int per_step = 100;
+    long spawned = 0, steps = 0;
+    size_t max_live = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (spawned < total || !main_stage->objects.empty()) {
+        for (int i=0; i<per_step && spawned < total; i++, spawned++) {
+            main_stage->add(make_meteor());
+        }
+        max_live = std::max(max_live, main_stage->objects.size());
+        main_stage->update(state);
+        steps++;
+
+        if (steps % 2000 == 0 || main_stage->objects.empty()) {
+            std::printf("%8ld spawned, %6zu live, capacity %6zu, slots %6zu\n",
+                spawned, main_stage->objects.size(), main_stage->objects.capacity(), main_stage->objects.slot_count());
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("%ld meteors, %ld steps, %.2f s, at most %zu live at once\n", total, steps, seconds, max_live);
+
+    // хранилище не должно держать больше мест, чем было живых объектов
+    return main_stage->objects.slot_count() == max_live ? 0 : 1;
+}
+
+// bench.cpp подключает этот файл целиком, со своей main()
+#ifndef LAB2_BENCH
 int main(int argc, char** argv) {
     srand(time(0));
+    if (argc > 1 && std::strcmp(argv[1], "stress") == 0) {
+        return stress(argc > 2 ? std::atol(argv[2]) : 1000000);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "scene") == 0) {
+        return scene_bench(argc > 2 ? std::atoi(argv[2]) : 1000, argc > 3 && std::strcmp(argv[3], "paused") == 0);
+    }
+    if (argc > 1 && std::strcmp(argv[1], "tessellation") == 0) {
+        return tessellation_bench(argc > 2 ? std::atol(argv[2]) : 10000, argc > 3 ? std::atoi(argv[3]) : 100);
+    }
     
     // glut
     GL::glutInit(&argc, argv);
@@ -676,14 +1320,23 @@ int main(int argc, char** argv) {
     
     GL::glOrtho(0, WINX, 0, WINY, 0, 1);
     
-    init_buffers();
+    bool draw_mode = argc > 1 && std::strcmp(argv[1], "draw") == 0;
+    // draw ... vertices: для сравнения без экземпляров
+    init_buffers(!(draw_mode && argc > 4 && std::strcmp(argv[4], "vertices") == 0));
     prepare();
     
-    GL::glutDisplayFunc(update);
+    if (draw_mode) {
+        long meteors = argc > 2 ? std::atol(argv[2]) : 10000;
+        for (long i=0; i<meteors; i++) main_stage->add(make_meteor());
+        drawFrames = argc > 3 ? std::atoi(argv[3]) : 100;
+        GL::glutDisplayFunc(draw_bench);
+    }
+    else GL::glutDisplayFunc(update);
     GL::glutReshapeFunc(reshape);
     GL::glutKeyboardFunc(keyboardKeys);
 
     GL::glutMainLoop();
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
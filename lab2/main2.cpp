@@ -9,6 +9,10 @@
 
 #include <memory>
 
+#include "../lab0/frame_scheduler.hpp"
+#include "../lab0/object_store.hpp"
+#include "../lab0/circle_tables.hpp"
+
 namespace GL {
     #include <GL/glew.h>
     #include <GL/freeglut.h>
@@ -55,11 +59,15 @@ struct Color {
 
 double FPS = 60.0f;
 double delaytime = 1000000.0f/FPS;
+// шаг симуляции равен state->dt, кадры - по абсолютным дедлайнам
+FrameScheduler scheduler(FPS);
 
 void setFPS(double nFPS) {
     if (nFPS <= 0) return;
     FPS = nFPS;
     delaytime = 1000000/nFPS;
+    scheduler.set_fps(nFPS);
+    scheduler.set_step(1/nFPS);
 }
 
 int WINX = 1200;
@@ -85,18 +93,17 @@ std::pair<std::vector<Point>, std::vector<Color>>
 draw_filled_ellipse(Point center, Point radii, Color color, int shapeness) {
     std::pair<std::vector<Point>, std::vector<Color>> result;
     
-    double koef = (2 * M_PI) / shapeness;
+    auto& circle = unit_circle(shapeness);
     
     // Центр для TRIANGLE_FAN
     result.first.push_back(center);
     result.second.push_back(color);
     
     // Точки окружности
-    for (int i = 0; i <= shapeness; i++) {
-        double angle = i * koef;
+    for (auto& p: circle) {
         result.first.push_back(Point(
-            center.x + cos(angle) * radii.x,
-            center.y + sin(angle) * radii.y
+            center.x + p.x * radii.x,
+            center.y + p.y * radii.y
         ));
         result.second.push_back(color);
     }
@@ -207,32 +214,25 @@ class ComplexObject: public UpdatableObject, public DrawableObject {};
 
 class Stage: public ComplexObject {
 public:
-    std::vector<std::shared_ptr<UpdatableObject>> updaties;
-    std::vector<std::shared_ptr<DrawableObject>> drawies;
+    // один handle на объект: он обновляется и рисуется, пока update не вернёт false
+    using Store = ObjectStore< std::shared_ptr<ComplexObject> >;
+    using Handle = Store::Handle;
+    Store objects;
 
-    void add_updatie(std::shared_ptr<UpdatableObject> obj) {
-        updaties.push_back(obj);
+    Handle add(std::shared_ptr<ComplexObject> obj) {
+        return objects.add(obj);
     }
 
-    void add_drawie(std::shared_ptr<DrawableObject> obj) {
-        drawies.push_back(obj);
+    bool remove(Handle handle) {
+        return objects.remove(handle);
     }
 
     bool update(std::shared_ptr<State> state) override {
-        std::vector<void*> to_remove;
-        for (auto& obj: updaties) {
-            if (!obj->update(state)) {
-                to_remove.push_back(obj.get());
-            }
-        }
-        for (void* ptr: to_remove) {
-            auto it = std::find_if(updaties.begin(), updaties.end(),
-                [ptr](const std::shared_ptr<UpdatableObject>& sp) {
-                    return sp.get() == ptr;
-                });
-            if (it != updaties.end()) {
-                updaties.erase(it);
-            }
+        // на место удалённого встаёт последний объект, он ещё не обновлён;
+        // объекты сцены добавлены раньше метеоров, их порядок не меняется
+        for (size_t i=0; i<objects.size(); ) {
+            if (objects[i]->update(state)) i++;
+            else objects.remove_at(i);
         }
         return true;
     }
@@ -241,7 +241,7 @@ public:
     draw(std::shared_ptr<DrawingContext> context) override {
         std::pair<std::vector<Point>, std::vector<Color>> result;
         
-        for (auto& obj: drawies) {
+        for (auto& obj: objects) {
             auto current = obj->draw(context);
 
             // Сохраняем количество вершин каждого объекта для отдельной отрисовки
@@ -314,11 +314,12 @@ public:
 
     std::pair<std::vector<Point>, std::vector<Color>> 
     draw(std::shared_ptr<DrawingContext> context) override {
+        Point radii(context->transform_x(radius), context->transform_y(radius));
         return draw_filled_ellipse(
             context->transform(center), 
-            Point(context->transform_x(radius), context->transform_y(radius)), 
+            radii, 
             color, 
-            100
+            circle_segments(std::max(radii.x, radii.y))
         );
     }
 };
@@ -427,6 +428,23 @@ std::shared_ptr<State> state;
 std::shared_ptr<DrawingContext> context;
 std::shared_ptr<Stage> main_stage;
 
+std::shared_ptr<Meteor> make_meteor() {
+    Point pos = Point(0.15 + drand()*0.7, 1 + drand()*0.2);
+    Point direction = Point((drand()*2-1)*0.1, -0.1 - drand()*0.5);
+    Color color = {0.8 + 0.2*drand(), 0.08*drand(), 0.08*drand(), 1};
+    double speed = 7 + 3*drand();
+    double radius = 0.01 + drand()*0.01;
+
+    std::shared_ptr<Circle> circle(
+        new Circle(pos, radius, color)
+    );
+    std::shared_ptr<Meteor> meteor(
+        new Meteor(circle, direction, speed)
+    );
+
+    return meteor;
+}
+
 void keyboardKeys(unsigned char key, int x, int y) {
     switch (key) {
         case ' ':
@@ -440,23 +458,8 @@ void keyboardKeys(unsigned char key, int x, int y) {
             }
             break;
         case 'M': case 'm': 
-        {
-            Point pos = Point(0.15 + drand()*0.7, 1 + drand()*0.2);
-            Point direction = Point((drand()*2-1)*0.1, -0.1 - drand()*0.5);
-            Color color = {0.8 + 0.2*drand(), 0.08*drand(), 0.08*drand(), 1};
-            double speed = 7 + 3*drand();
-            double radius = 0.01 + drand()*0.01;
-
-            std::shared_ptr<Circle> circle(
-                new Circle(pos, radius, color)
-            );
-            std::shared_ptr<Meteor> meteor(
-                new Meteor(circle, direction, speed)
-            );
-
-            main_stage->add_updatie(meteor);
-            main_stage->add_drawie(meteor);
-        } break;
+            main_stage->add(make_meteor());
+            break;
         default:
             break;
     }
@@ -485,8 +488,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
     
     {// Sun & Moon
@@ -497,8 +499,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(sun);
-        main_stage->add_drawie(sun);
+        main_stage->add(sun);
 
         std::shared_ptr<RotatingAnimation> moon(
             new RotatingAnimation( 
@@ -507,8 +508,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(moon);
-        main_stage->add_drawie(moon);
+        main_stage->add(moon);
     }
 
     {// Ground
@@ -524,8 +524,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
 
     {// House
@@ -542,8 +541,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
 
     {// House roof
@@ -561,8 +559,7 @@ void prepare() {
             )
         );
 
-        main_stage->add_updatie(anim);
-        main_stage->add_drawie(anim);
+        main_stage->add(anim);
     }
 }
 
@@ -626,16 +623,12 @@ void draw() {
 }
 
 void update() {
-    using namespace std::chrono;
-    
-    auto start = steady_clock::now();
-    main_stage->update(state);
+    // столько шагов по state->dt, сколько прошло реального времени
+    scheduler.advance([](double) {
+        main_stage->update(state);
+    });
     draw();
-    auto end = steady_clock::now();
-    
-    double dur = duration_cast<microseconds>(end-start).count();
-    if (dur < delaytime)
-        usleep(delaytime - dur);
+    scheduler.wait();
 }
 
 int main(int argc, char** argv) {
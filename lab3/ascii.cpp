@@ -0,0 +1,128 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/ioctl.h>
+#endif
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include "scene.hpp"
+#include "ascii_renderer.hpp"
+
+// яркость цвета объекта: в символах остаётся только она
+static float luminance(glm::vec3 c) {
+    return 0.2126f*c.x + 0.7152f*c.y + 0.0722f*c.z;
+}
+
+// Та же сцена, что в main.cpp, отрисованная AsciiRenderer.
+static void render_frame(AsciiRenderer& renderer, const std::vector<float>& sphere, float aspect) {
+    glm::mat4 model(1);
+    model = glm::rotate(model, object_rotation_x, glm::vec3(0.0f, 1.0f, 0.0f));
+    model = glm::rotate(model, object_rotation_y, glm::vec3(0.0f, 0.0f, 1.0f));
+
+    glm::mat4 light_model(1);
+    light_model = glm::rotate(light_model, -light_rotation, glm::vec3(0.0f, 1.0f, 0.0f));
+    light_model = model*light_model;
+    auto real_light_position = glm::vec3(light_model*glm::vec4(lighsource_position, 1.0f));
+
+    glm::mat4 view = glm::lookAt(camera_position, camera_position + camera_direction, glm::vec3(0,1,0));
+    glm::mat4 projection = glm::perspective(45.0f, aspect, 0.1f, 100.0f);
+
+    renderer.clear();
+    for (int i=0; i<COUNT; i++) {
+        renderer.draw(cube_vertexes[i], 6, model, view, projection, scale_from_origin, luminance(color));
+    }
+    renderer.draw(sphere.data(), sphere.size()/6, light_model, view, projection, 0, luminance(lightColor));
+
+    Lighting light = {real_light_position, camera_position, ambientStrength, specularStrength, shininess};
+    renderer.shade(light);
+}
+
+static void animate() {
+    light_rotation += 0.05;
+    object_rotation_x += 0.03;
+    object_rotation_y += 0.01;
+}
+
+// Без терминала: кадры 200x60 в /dev/null, время по этапам.
+static int bench(int frames) {
+    using namespace std::chrono;
+    int fd = open("/dev/null", O_WRONLY);
+    StreamHandler sh(std::cout, 200, 60);
+    sh.set_output_fd(fd);
+    AsciiRenderer renderer(sh);
+    auto sphere = generate_sphere(lighsource_position, sphere_radius, 24);
+    float aspect = 200*0.5f/60;
+
+    double render_ms = 0, flush_ms = 0;
+    for (int f=0; f<frames; f++) {
+        auto start = steady_clock::now();
+        sh.clear();
+        render_frame(renderer, sphere, aspect);
+        auto rendered = steady_clock::now();
+        sh.flush_diff();
+        auto flushed = steady_clock::now();
+
+        render_ms += duration<double, std::milli>(rendered - start).count();
+        flush_ms += duration<double, std::milli>(flushed - rendered).count();
+        animate();
+    }
+    close(fd);
+
+    double frame_ms = (render_ms + flush_ms)/frames;
+    std::printf("200x60, %d frames: render %.3f ms, flush %.3f ms, %.0f fps\n", frames, render_ms/frames, flush_ms/frames, 1000/frame_ms);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::strcmp(argv[1], "bench") == 0) {
+        return bench(argc > 2 ? std::atoi(argv[2]) : 300);
+    }
+
+    int columns, rows;
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO csbi;
+    GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &csbi);
+    columns = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+    rows = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+#else
+    struct winsize w;
+    ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+    columns = w.ws_col;
+    rows = w.ws_row;
+#endif
+
+    // последняя строка терминала - под статистику вывода
+    StreamHandler sh(std::cout, columns, rows - 1);
+#ifndef _WIN32
+    sh.set_output_fd(STDOUT_FILENO);
+#endif
+    sh.show_stats(true);
+
+    AsciiRenderer renderer(sh);
+    auto sphere = generate_sphere(lighsource_position, sphere_radius, 24);
+    // символ терминала примерно вдвое выше своей ширины
+    float aspect = columns*0.5f/(rows - 1);
+
+    sh.start_writer(StreamHandler::DIFF, StreamHandler::DROP_OLDEST);
+    while (1) {
+        sh.clear();
+        render_frame(renderer, sphere, aspect);
+        sh.present();
+        usleep(33000);
+        animate();
+    }
+
+    return 0;
+}
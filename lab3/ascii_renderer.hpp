@@ -0,0 +1,282 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <limits>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+// после glm: stream_utils.hpp определяет макросы min/max
+#include "../lab0/stream_utils.hpp"
+
+// Uniforms of the fragment shader that are the same for the whole frame
+struct Lighting {
+    glm::vec3 light_position;
+    glm::vec3 view_position;
+    float ambient;
+    float specular;
+    int shininess;
+};
+
+// CPU copy of the lab3 pipeline for the ASCII canvas: the vertex shader,
+// clipping against the view frustum and a z-buffered rasterizer that
+// fills a G-buffer (depth, world position, normal, albedo, one plane
+// each). shade() runs the Phong model of the fragment shader over the
+// G-buffer and maps the intensity to a character ramp.
+// Inner loops work on whole rows of planes without branches, so the
+// compiler vectorizes them.
+class AsciiRenderer {
+    StreamHandler& sh;
+    int width, height;
+
+    std::vector<float> depth, px, py, pz, nx, ny, nz, albedo;
+    std::vector<float> intensity, spec_base, spec;
+
+    struct ClipVertex {
+        glm::vec4 clip;
+        glm::vec3 world;
+        glm::vec3 normal;
+    };
+
+    static ClipVertex lerp(const ClipVertex& a, const ClipVertex& b, float t) {
+        return {a.clip + (b.clip - a.clip)*t, a.world + (b.world - a.world)*t, a.normal + (b.normal - a.normal)*t};
+    }
+
+    // signed distance to plane i of the clip volume, inside when >= 0
+    static float plane_distance(const glm::vec4& v, int plane) {
+        switch (plane) {
+            case 0: return v.w + v.x;
+            case 1: return v.w - v.x;
+            case 2: return v.w + v.y;
+            case 3: return v.w - v.y;
+            case 4: return v.w + v.z;
+            default: return v.w - v.z;
+        }
+    }
+
+    // Sutherland-Hodgman in homogeneous coordinates; a triangle clipped by
+    // six planes has at most nine vertices
+    static int clip_polygon(ClipVertex* poly, int count) {
+        ClipVertex buffer[9];
+        for (int plane=0; plane<6 && count > 0; plane++) {
+            int kept = 0;
+            for (int i=0; i<count; i++) {
+                const ClipVertex& a = poly[i];
+                const ClipVertex& b = poly[(i + 1) % count];
+                float da = plane_distance(a.clip, plane);
+                float db = plane_distance(b.clip, plane);
+                if (da >= 0) buffer[kept++] = a;
+                if ((da >= 0) != (db >= 0)) buffer[kept++] = lerp(a, b, da / (da - db));
+            }
+            count = kept;
+            std::copy(buffer, buffer + count, poly);
+        }
+        return count;
+    }
+
+    // vertex after the perspective divide: cell coordinates, NDC depth and
+    // the attributes premultiplied by 1/w for perspective-correct interpolation
+    struct ScreenVertex {
+        float x, y, z, q;
+        float attr[6];
+    };
+
+    static ScreenVertex to_screen(const ClipVertex& v, int width, int height) {
+        ScreenVertex s;
+        s.q = 1 / v.clip.w;
+        s.x = (v.clip.x*s.q + 1)*0.5f*width - 0.5f;
+        s.y = (1 - v.clip.y*s.q)*0.5f*height - 0.5f;
+        s.z = v.clip.z*s.q;
+        float attr[6] = {v.world.x, v.world.y, v.world.z, v.normal.x, v.normal.y, v.normal.z};
+        for (int i=0; i<6; i++) s.attr[i] = attr[i]*s.q;
+        return s;
+    }
+
+    struct Setup {
+        float a[3], b[3], c[3]; // l_i(x, y) = c_i + x*a_i + y*b_i
+        float z[3], q[3];
+        float attr[3][6];
+        float material;
+    };
+
+    void raster(const ScreenVertex& v0, const ScreenVertex& v1, const ScreenVertex& v2, float material) {
+        float area = (v1.x - v0.x)*(v2.y - v0.y) - (v1.y - v0.y)*(v2.x - v0.x);
+        if (!(std::abs(area) > 1e-12f)) return;
+
+        int minx = (std::max)(0, (int)std::ceil((std::min)({v0.x, v1.x, v2.x})));
+        int maxx = (std::min)(width - 1, (int)std::floor((std::max)({v0.x, v1.x, v2.x})));
+        int miny = (std::max)(0, (int)std::ceil((std::min)({v0.y, v1.y, v2.y})));
+        int maxy = (std::min)(height - 1, (int)std::floor((std::max)({v0.y, v1.y, v2.y})));
+        if (minx > maxx || miny > maxy) return;
+
+        // barycentric l_i(x, y) = c_i + x*a_i + y*b_i, already divided by the area
+        const ScreenVertex* v[3] = {&v0, &v1, &v2};
+        Setup setup;
+        for (int i=0; i<3; i++) {
+            const ScreenVertex& p = *v[(i + 1) % 3];
+            const ScreenVertex& r = *v[(i + 2) % 3];
+            setup.a[i] = (p.y - r.y) / area;
+            setup.b[i] = (r.x - p.x) / area;
+            setup.c[i] = (p.x*r.y - r.x*p.y) / area;
+            setup.z[i] = v[i]->z;
+            setup.q[i] = v[i]->q;
+            for (int k=0; k<6; k++) setup.attr[i][k] = v[i]->attr[k];
+        }
+        setup.material = material;
+
+        for (int y=miny; y<=maxy; y++) {
+            size_t row = (size_t)y * width;
+            raster_row(
+                setup, y, minx, maxx, depth.data() + row,
+                px.data() + row, py.data() + row, pz.data() + row,
+                nx.data() + row, ny.data() + row, nz.data() + row,
+                albedo.data() + row
+            );
+        }
+    }
+
+    // Depth test and G-buffer write for cells x0..x1 of row y. The planes
+    // never overlap; restrict is lost once the call is inlined, so ivdep
+    // says it again and the loop vectorizes without alias checks.
+    static void raster_row(
+        const Setup& s, int y, int x0, int x1, float* __restrict depth,
+        float* __restrict px, float* __restrict py, float* __restrict pz,
+        float* __restrict nx, float* __restrict ny, float* __restrict nz,
+        float* __restrict albedo
+    ) {
+        float e0 = s.c[0] + y*s.b[0], e1 = s.c[1] + y*s.b[1], e2 = s.c[2] + y*s.b[2];
+#pragma GCC ivdep
+        for (int x=x0; x<=x1; x++) {
+            float d = depth[x];
+            float l0 = e0 + x*s.a[0], l1 = e1 + x*s.a[1], l2 = e2 + x*s.a[2];
+            float z = l0*s.z[0] + l1*s.z[1] + l2*s.z[2];
+            bool pass = ((std::min)((std::min)(l0, l1), l2) >= 0) & (z < d);
+            float w = 1 / (l0*s.q[0] + l1*s.q[1] + l2*s.q[2]);
+
+            depth[x] = pass ? z : d;
+            float v0 = (l0*s.attr[0][0] + l1*s.attr[1][0] + l2*s.attr[2][0])*w; px[x] = pass ? v0 : px[x];
+            float v1 = (l0*s.attr[0][1] + l1*s.attr[1][1] + l2*s.attr[2][1])*w; py[x] = pass ? v1 : py[x];
+            float v2 = (l0*s.attr[0][2] + l1*s.attr[1][2] + l2*s.attr[2][2])*w; pz[x] = pass ? v2 : pz[x];
+            float v3 = (l0*s.attr[0][3] + l1*s.attr[1][3] + l2*s.attr[2][3])*w; nx[x] = pass ? v3 : nx[x];
+            float v4 = (l0*s.attr[0][4] + l1*s.attr[1][4] + l2*s.attr[2][4])*w; ny[x] = pass ? v4 : ny[x];
+            float v5 = (l0*s.attr[0][5] + l1*s.attr[1][5] + l2*s.attr[2][5])*w; nz[x] = pass ? v5 : nz[x];
+            albedo[x] = pass ? s.material : albedo[x];
+        }
+    }
+
+    // Ambient + diffuse into result and the specular base max(dot(V, R), 0)
+    // into base, for every cell of the G-buffer.
+    static void phong(
+        size_t cells, const Lighting& light,
+        const float* __restrict px, const float* __restrict py, const float* __restrict pz,
+        const float* __restrict nx, const float* __restrict ny, const float* __restrict nz,
+        float* __restrict base, float* __restrict result
+    ) {
+        for (size_t i=0; i<cells; i++) {
+            float n_len = 1 / std::sqrt(nx[i]*nx[i] + ny[i]*ny[i] + nz[i]*nz[i]);
+            float n0 = nx[i]*n_len, n1 = ny[i]*n_len, n2 = nz[i]*n_len;
+
+            float l0 = light.light_position.x - px[i];
+            float l1 = light.light_position.y - py[i];
+            float l2 = light.light_position.z - pz[i];
+            float l_len = 1 / std::sqrt(l0*l0 + l1*l1 + l2*l2);
+            l0 *= l_len; l1 *= l_len; l2 *= l_len;
+
+            float v0 = light.view_position.x - px[i];
+            float v1 = light.view_position.y - py[i];
+            float v2 = light.view_position.z - pz[i];
+            float v_len = 1 / std::sqrt(v0*v0 + v1*v1 + v2*v2);
+            v0 *= v_len; v1 *= v_len; v2 *= v_len;
+
+            float n_dot_l = n0*l0 + n1*l1 + n2*l2;
+            float diffuse = (std::max)(-n_dot_l, 0.0f);
+
+            // reflect(-L, N) = 2*dot(N, L)*N - L
+            float r0 = 2*n_dot_l*n0 - l0, r1 = 2*n_dot_l*n1 - l1, r2 = 2*n_dot_l*n2 - l2;
+            base[i] = (std::max)(v0*r0 + v1*r1 + v2*r2, 0.0f);
+            result[i] = light.ambient + diffuse;
+        }
+    }
+public:
+    // characters from dark to bright
+    static constexpr const char* ramp = " .:-=+*#%@";
+
+    AsciiRenderer(StreamHandler& sh): sh(sh) {
+        auto size = sh.size();
+        width = size.first;
+        height = size.second;
+        size_t cells = (size_t)width * height;
+        for (auto* plane: {&depth, &px, &py, &pz, &nx, &ny, &nz, &albedo, &intensity, &spec_base, &spec}) {
+            plane->assign(cells, 0);
+        }
+        clear();
+    }
+
+    void clear() {
+        std::fill(depth.begin(), depth.end(), std::numeric_limits<float>::infinity());
+    }
+
+    // Draws GL_TRIANGLES from interleaved position/normal data, the layout
+    // of cube_vertexes, through the lab3 vertex shader.
+    void draw(
+        const float* vertexes, int count,
+        const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection,
+        float scale_from_origin, float material
+    ) {
+        glm::mat4 view_projection = projection * view;
+        glm::mat3 normal_matrix = glm::mat3(glm::transpose(glm::inverse(model)));
+
+        for (int t=0; t+2<count; t+=3) {
+            ClipVertex poly[9];
+            for (int i=0; i<3; i++) {
+                const float* v = vertexes + (t + i)*6;
+                glm::vec3 position(v[0], v[1], v[2]);
+                glm::vec3 normal(v[3], v[4], v[5]);
+                glm::vec3 world = glm::vec3(model * glm::vec4(position - scale_from_origin*normal, 1.0f));
+                poly[i] = {view_projection * glm::vec4(world, 1.0f), world, normal_matrix * normal};
+            }
+
+            int n = clip_polygon(poly, 3);
+            if (n < 3) continue;
+
+            ScreenVertex screen[9];
+            for (int i=0; i<n; i++) screen[i] = to_screen(poly[i], width, height);
+            for (int i=1; i+1<n; i++) raster(screen[0], screen[i], screen[i + 1], material);
+        }
+    }
+
+    // Phong lighting of every covered cell, written to the canvas as ramp
+    // characters; empty cells are left alone.
+    void shade(const Lighting& light) {
+        size_t cells = depth.size();
+        float* base = spec_base.data();
+        float* result = intensity.data();
+        phong(cells, light, px.data(), py.data(), pz.data(), nx.data(), ny.data(), nz.data(), base, result);
+
+        // pow(base, shininess) by squaring, one pass per bit of the exponent
+        float* power = spec.data();
+        std::fill(spec.begin(), spec.end(), 1.0f);
+        for (int e=light.shininess; e>0; e>>=1) {
+            if (e & 1) {
+                for (size_t i=0; i<cells; i++) power[i] *= base[i];
+            }
+            for (size_t i=0; i<cells; i++) base[i] *= base[i];
+        }
+
+        const int levels = std::strlen(ramp);
+        for (size_t i=0; i<cells; i++) {
+            result[i] = (result[i] + light.specular*power[i]) * albedo[i] * (levels - 1) + 0.5f;
+        }
+
+        const float* z = depth.data();
+        for (int y=0; y<height; y++) {
+            for (int x=0; x<width; x++) {
+                size_t i = (size_t)y * width + x;
+                if (!(z[i] < std::numeric_limits<float>::infinity())) continue;
+                int level = (int)result[i];
+                sh.at(x, y) = ramp[(std::min)((std::max)(level, 0), levels - 1)];
+            }
+        }
+    }
+};
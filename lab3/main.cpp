@@ -18,6 +18,8 @@ namespace GL {
 #include <glm/mat4x4.hpp>
 #include <glm/ext.hpp>
 
+#include "scene.hpp"
+
 // Function to check shader compilation errors
 bool checkShaderCompilation(GL::GLuint shader, const char* type) {
     GL::GLint success;
@@ -44,178 +46,6 @@ bool checkProgramLinking(GL::GLuint program) {
     return true;
 }
 
-enum {
-    FRONT = 0,
-    BACK,
-    RIGHT,
-    LEFT,
-    BOTTOM,
-    TOP,
-
-    COUNT
-};
-
-float cube_vertexes[6][36] = {
-    // Positions          // Normals
-    // Front
-    {-0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-     0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-     0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-     0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-    -0.5f,  0.5f,  0.5f,  0.0f,  0.0f,  1.0f,
-    -0.5f, -0.5f,  0.5f,  0.0f,  0.0f,  1.0f,},
-
-    // Back
-    {-0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-     0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-     0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-     0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-    -0.5f,  0.5f, -0.5f,  0.0f,  0.0f, -1.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f,  0.0f, -1.0f,},
-
-    // Left
-    {-0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
-    -0.5f, -0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
-    -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
-    -0.5f,  0.5f,  0.5f, -1.0f,  0.0f,  0.0f,
-    -0.5f,  0.5f, -0.5f, -1.0f,  0.0f,  0.0f,
-    -0.5f, -0.5f, -0.5f, -1.0f,  0.0f,  0.0f,},
-
-    // Right
-    { 0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
-     0.5f, -0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
-     0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
-     0.5f,  0.5f,  0.5f,  1.0f,  0.0f,  0.0f,
-     0.5f,  0.5f, -0.5f,  1.0f,  0.0f,  0.0f,
-     0.5f, -0.5f, -0.5f,  1.0f,  0.0f,  0.0f,},
-
-    // Bottom
-    {-0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
-     0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,
-     0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
-     0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
-    -0.5f, -0.5f,  0.5f,  0.0f, -1.0f,  0.0f,
-    -0.5f, -0.5f, -0.5f,  0.0f, -1.0f,  0.0f,},
-
-    // Top
-    {-0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,
-     0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f,
-     0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
-     0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
-    -0.5f,  0.5f,  0.5f,  0.0f,  1.0f,  0.0f,
-    -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f}
-};
-
-std::vector< float > generate_sphere(glm::vec3 center, float radius, int smooth) {
-    std::vector< float > result;
-
-    float delta_phi = 2*glm::pi<float>() / smooth;
-    float delta_theta = 2*glm::pi<float>() / smooth;
-
-    float phi = 0;
-    float theta = 0;
-    for (int i=0; i<smooth + 1; i++) {
-        for (int j=0; j<smooth + 1; j++) {
-            glm::vec3 dir = {
-                radius*glm::cos(phi)*glm::cos(theta), 
-                radius*glm::sin(phi)*glm::cos(theta),
-                radius*glm::sin(theta)
-            };
-            glm::vec3 dir1 = {
-                radius*glm::cos(phi + delta_phi)*glm::cos(theta), 
-                radius*glm::sin(phi + delta_phi)*glm::cos(theta),
-                radius*glm::sin(theta)
-            };
-            glm::vec3 dir2 = {
-                radius*glm::cos(phi)*glm::cos(theta + delta_theta), 
-                radius*glm::sin(phi)*glm::cos(theta + delta_theta),
-                radius*glm::sin(theta + delta_theta)
-            };
-            glm::vec3 dir3 = {
-                radius*glm::cos(phi + delta_phi)*glm::cos(theta + delta_theta), 
-                radius*glm::sin(phi + delta_phi)*glm::cos(theta + delta_theta),
-                radius*glm::sin(theta + delta_theta)
-            };
-
-            glm::vec3 point = center + dir;
-            glm::vec3 point1 = center + dir1;
-            glm::vec3 point2 = center + dir2;
-            glm::vec3 point3 = center + dir3;
-
-            dir = glm::normalize(dir);
-            dir1 = glm::normalize(dir1);
-            dir2 = glm::normalize(dir2);
-            dir3 = glm::normalize(dir3);
-
-            result.push_back(point.x);
-            result.push_back(point.y);
-            result.push_back(point.z);
-            result.push_back(dir.x);
-            result.push_back(dir.y);
-            result.push_back(dir.z);
-
-            result.push_back(point1.x);
-            result.push_back(point1.y);
-            result.push_back(point1.z);
-            result.push_back(dir1.x);
-            result.push_back(dir1.y);
-            result.push_back(dir1.z);
-
-            result.push_back(point2.x);
-            result.push_back(point2.y);
-            result.push_back(point2.z);
-            result.push_back(dir2.x);
-            result.push_back(dir2.y);
-            result.push_back(dir2.z);
-
-
-
-            result.push_back(point1.x);
-            result.push_back(point1.y);
-            result.push_back(point1.z);
-            result.push_back(dir1.x);
-            result.push_back(dir1.y);
-            result.push_back(dir1.z);
-
-            result.push_back(point2.x);
-            result.push_back(point2.y);
-            result.push_back(point2.z);
-            result.push_back(dir2.x);
-            result.push_back(dir2.y);
-            result.push_back(dir2.z);
-            
-            result.push_back(point3.x);
-            result.push_back(point3.y);
-            result.push_back(point3.z);
-            result.push_back(dir3.x);
-            result.push_back(dir3.y);
-            result.push_back(dir3.z);
-
-            theta += delta_theta;
-        }
-        phi += delta_phi;
-    }
-
-    return result;
-}
-
-glm::vec3 color = {0.5, 0.5, 0.8};
-float scale_from_origin = 1.0f;
-
-glm::vec3 camera_position = {-2, 2, -2};
-glm::vec3 camera_direction = {1, -1, 1};
-
-glm::vec3 lighsource_position = {1, 1.25, 0};
-glm::vec3 lightColor(1.0f, 1.0f, 1.0f);
-float ambientStrength = 0.45f;
-float specularStrength = 0.55f;
-int shininess = 64;
-float sphere_radius = 0.25;
-
-float light_rotation = 0;
-float object_rotation_x = 0;
-float object_rotation_y = 0;
-
 int main(int argc, char** argv) {
     (void)(argc); (void)(argv);
 